@@ -1,6 +1,14 @@
 from m5.objects import Cache
+from m5.objects import SetAssociative, SkewedAssociative, XorSetAssociative
 from m5.params import *
 
+# Set index functions of the metadata cache by name
+meta_indexing_policies = {
+    "modulo": SetAssociative,
+    "xor": XorSetAssociative,
+    "skewed": SkewedAssociative,
+}
+
 class MetaCache(Cache):
     size = '128kB'
     assoc = 4
@@ -10,3 +18,9 @@ class MetaCache(Cache):
     mshrs = 4
     tgts_per_mshr = 20
     #  addr_ranges = AddrRange([0x51000000, 0x52249000])
+
+    def set_indexing(self, name):
+        """
+        Index the sets by the named function of meta_indexing_policies.
+        """
+        self.tags.indexing_policy = meta_indexing_policies[name]()
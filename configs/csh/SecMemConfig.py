@@ -2,7 +2,7 @@ import m5.objects
 from m5.objects import *
 from common import ObjectList
 from common import HMC
-from MetaCache import MetaCache
+from MetaCache import MetaCache, meta_indexing_policies
 
 def create_mem_intf(intf, r, i, intlv_bits, intlv_size,
                     xor_low_bit):
@@ -69,6 +69,359 @@ def create_mem_intf(intf, r, i, intlv_bits, intlv_size,
                                       intlvMatch = i)
     return interface
 
+def add_sec_options(parser):
+    """
+    Add the options tuning the secure memory controller, so that design
+    space sweeps do not need a rebuild.
+    """
+    parser.add_argument("--sec-transactions", type=int,
+                        help="Secure transactions in flight")
+    parser.add_argument("--sec-counter-mode",
+                        choices=["monolithic", "split", "morphable"],
+                        help="Layout of the encryption counters")
+    parser.add_argument("--sec-counter-encoding",
+                        choices=["uniform", "zcc", "adaptive"],
+                        help="Encoding of morphable counter blocks")
+    parser.add_argument("--sec-counter-size", type=int,
+                        help="Bits per encryption counter, by default 7 "
+                        "in split mode and 8 otherwise")
+    parser.add_argument("--sec-mac-size", type=int,
+                        help="Bytes of MAC per data block")
+    parser.add_argument("--sec-mac-inline", action="store_true",
+                        help="Carry MACs in the ECC bits of the data")
+    parser.add_argument("--sec-mac-burst-latency", type=int,
+                        help="Extra cycles to transfer an inline MAC")
+    parser.add_argument("--sec-tree-arity", type=int,
+                        help="Children per Merkle Tree node")
+    parser.add_argument("--sec-tree-levels", type=int,
+                        help="Merkle Tree levels including the root")
+    parser.add_argument("--sec-pinned-levels", type=int,
+                        help="Top Merkle Tree levels kept on chip")
+    parser.add_argument("--sec-pinned-latency", type=int,
+                        help="Cycles to access a pinned tree node")
+    parser.add_argument("--sec-tree-fetch-window", type=int,
+                        help="Tree levels a read walk fetches in parallel, "
+                        "0 for all of them")
+    parser.add_argument("--sec-lazy-tree", action="store_true",
+                        help="Update the Merkle Tree when the metadata "
+                        "cache evicts dirty nodes instead of on writes")
+    parser.add_argument("--sec-speculation-window", type=int,
+                        help="Read responses sent to the CPU before their "
+                        "verification finishes")
+    parser.add_argument("--sec-write-buffer", type=int,
+                        help="Writes acknowledged once buffered, with "
+                        "their verification drained in the background")
+    parser.add_argument("--sec-prefetcher", default="none",
+                        choices=["none", "stride", "stream"],
+                        help="Prefetcher of the counters and MACs of "
+                        "upcoming data blocks")
+    parser.add_argument("--sec-prefetch-degree", type=int,
+                        help="Data blocks predicted per access")
+    parser.add_argument("--sec-prefetch-distance", type=int,
+                        help="Data blocks between an access and the "
+                        "first predicted one")
+    parser.add_argument("--sec-meta-trace", type=str,
+                        help="Binary trace of the metadata accesses in the "
+                        "output directory, gzipped if it ends in .gz")
+    parser.add_argument("--sec-timeline", type=str,
+                        help="Chrome trace event JSON of the transactions "
+                        "in the output directory, for chrome://tracing or "
+                        "Perfetto")
+    parser.add_argument("--sec-host-profile", action="store_true",
+                        help="Measure the host time SecCtrl spends on "
+                        "requests and responses")
+    parser.add_argument("--sec-hash-latency", type=int,
+                        help="Cycles to hash a Merkle Tree node")
+    parser.add_argument("--sec-mac-latency", type=int,
+                        help="Cycles to compute a MAC")
+    parser.add_argument("--sec-aes-latency", type=int,
+                        help="Cycles to generate an encryption pad")
+    parser.add_argument("--sec-aes-units", type=int,
+                        help="Pipelined AES units of the crypto engine")
+    parser.add_argument("--sec-hash-units", type=int,
+                        help="Pipelined hash units of the crypto engine")
+    parser.add_argument("--sec-mac-units", type=int,
+                        help="Pipelined MAC units of the crypto engine")
+    parser.add_argument("--sec-crypto-ii", type=int,
+                        help="Initiation interval of the crypto units")
+    parser.add_argument("--sec-crypto-queue", type=int,
+                        help="Crypto operations waiting for a unit before "
+                        "new requests stall")
+    parser.add_argument("--sec-crypto-clock", type=str,
+                        help="Clock of the crypto engine, the controller "
+                        "clock when not given")
+    parser.add_argument("--sec-meta-caches", default="shared",
+                        choices=["shared", "split"],
+                        help="One metadata cache, or one each for "
+                        "counters, MACs and tree nodes")
+    parser.add_argument("--sec-meta-cache-size", type=str,
+                        help="Size of the shared metadata cache")
+    parser.add_argument("--sec-meta-cache-assoc", type=int,
+                        help="Associativity of the shared metadata cache")
+    for kind in ["counter", "mac", "tree"]:
+        parser.add_argument("--sec-%s-cache-size" % kind, type=str,
+                            help="Size of the split %s cache" % kind)
+        parser.add_argument("--sec-%s-cache-assoc" % kind, type=int,
+                            help="Associativity of the split %s cache" %
+                            kind)
+    parser.add_argument("--sec-meta-indexing", default="modulo",
+                        choices=list(meta_indexing_policies.keys()),
+                        help="Set index function of the metadata caches")
+    parser.add_argument("--sec-shadow-cache", action="store_true",
+                        help="Count the conflict misses of the shared "
+                        "metadata cache against a fully associative one")
+    parser.add_argument("--sec-level-aware", action="store_true",
+                        help="Keep Merkle Tree nodes longer the higher "
+                        "their level in the cache holding them")
+    parser.add_argument("--sec-level-weight", type=str,
+                        help="Time a tree node is kept as more recently "
+                        "used per level")
+
+def create_sec_ctrl(options, data_size):
+    """
+    Create a secure memory controller protecting data_size bytes, with
+    the parameters given on the command-line.
+    """
+
+    sec_ctrl = SecCtrl(data_size = data_size)
+
+    opt_params = [
+        ("sec_transactions", "num_transactions"),
+        ("sec_counter_mode", "counter_mode"),
+        ("sec_counter_size", "counter_size"),
+        ("sec_counter_encoding", "counter_encoding"),
+        ("sec_mac_size", "mac_size"),
+        ("sec_tree_arity", "tree_arity"),
+        ("sec_tree_levels", "tree_levels"),
+        ("sec_speculation_window", "speculation_window"),
+        ("sec_write_buffer", "write_buffer_size"),
+        ("sec_meta_trace", "meta_trace_file"),
+        ("sec_timeline", "timeline_file"),
+        ("sec_pinned_levels", "pinned_levels"),
+        ("sec_tree_fetch_window", "tree_fetch_window"),
+        ("sec_mac_burst_latency", "mac_burst_latency"),
+        ("sec_pinned_latency", "pinned_latency"),
+    ]
+    if getattr(options, "sec_lazy_tree", False):
+        sec_ctrl.lazy_tree_updates = True
+    if getattr(options, "sec_mac_inline", False):
+        sec_ctrl.mac_inline = True
+    if getattr(options, "sec_host_profile", False):
+        sec_ctrl.host_profile = True
+
+    for opt, param in opt_params:
+        value = getattr(options, opt, None)
+        if value is not None:
+            setattr(sec_ctrl, param, value)
+
+    crypto_params = [
+        ("sec_hash_latency", "hash_latency"),
+        ("sec_mac_latency", "mac_latency"),
+        ("sec_aes_latency", "aes_latency"),
+        ("sec_aes_units", "aes_units"),
+        ("sec_hash_units", "hash_units"),
+        ("sec_mac_units", "mac_units"),
+        ("sec_crypto_ii", "initiation_interval"),
+        ("sec_crypto_queue", "queue_depth"),
+    ]
+    for opt, param in crypto_params:
+        value = getattr(options, opt, None)
+        if value is not None:
+            setattr(sec_ctrl.crypto, param, value)
+
+    prefetcher = getattr(options, "sec_prefetcher", "none")
+    if prefetcher == "stride":
+        sec_ctrl.prefetcher = StrideMetaPrefetcher()
+    elif prefetcher == "stream":
+        sec_ctrl.prefetcher = StreamMetaPrefetcher()
+    if prefetcher != "none":
+        for opt, param in [("sec_prefetch_degree", "degree"),
+                           ("sec_prefetch_distance", "distance")]:
+            value = getattr(options, opt, None)
+            if value is not None:
+                setattr(sec_ctrl.prefetcher, param, value)
+
+    clock = getattr(options, "sec_crypto_clock", None)
+    if clock is not None:
+        sec_ctrl.crypto.clk_domain = SrcClockDomain(clock = clock,
+                voltage_domain = VoltageDomain())
+
+    return sec_ctrl
+
+def secure_mem_borders(sec_ctrl):
+    """
+    Return the start of the counters, of the MACs and of every stored
+    Merkle Tree level of a secure memory controller. The last tree
+    border is the end of its metadata. The borders come from SecLayout,
+    which lays the metadata out for SecCtrl as well.
+    """
+
+    import _m5
+    from m5.util import fatal
+
+    error, cnt_border, mac_border, mt_borders = _m5.sec_layout.borders(
+        sec_ctrl.data_size.value, sec_ctrl.counter_mode.value,
+        sec_ctrl.counter_size.value, sec_ctrl.mac_size.value,
+        sec_ctrl.mac_inline.value, sec_ctrl.tree_arity.value,
+        sec_ctrl.tree_levels.value, sec_ctrl.pinned_levels.value)
+    if error:
+        fatal("Bad secure memory layout: %s" % error)
+
+    return cnt_border, mac_border, mt_borders
+
+def secure_mem_size(sec_ctrl):
+    """
+    Return the bytes of backing memory needed by a secure memory
+    controller, i.e. the protected data followed by its metadata.
+    """
+
+    return secure_mem_borders(sec_ctrl)[2][-1]
+
+def intlv_addr(addr, masks, match):
+    """
+    Return the address a channel-local address has in an interleaved
+    range, mirroring AddrRange::addIntlvBits.
+    """
+
+    lsbs = [(mask & -mask).bit_length() - 1 for mask in masks]
+
+    # Make room for the interleaving bits, the lowest first
+    for bit in sorted(lsbs):
+        low = addr & ((1 << bit) - 1)
+        addr = ((addr >> bit) << (bit + 1)) | low
+
+    # Set each of them so that its mask selects the channel
+    for i, (mask, bit) in enumerate(zip(masks, lsbs)):
+        parity = bin(addr & mask).count("1") & 1
+        addr |= (parity ^ ((match >> i) & 1)) << bit
+
+    return addr
+
+def create_meta_caches(options, sec_ctrl, mem_range=None):
+    """
+    Create the metadata caches of a secure memory controller, either a
+    single shared one or one per kind of metadata, each serving only the
+    region of its kind. The metadata is sent to the addresses it has in
+    mem_range, the interleaved range of the channel if there are several.
+    """
+
+    interleaved = mem_range is not None and len(mem_range.masks) > 0
+
+    def cache_range(start, end):
+        if not interleaved:
+            return m5.objects.AddrRange(start, end)
+        # The stripes of the channel from the first to the last block
+        return m5.objects.AddrRange(
+                intlv_addr(start, mem_range.masks, mem_range.intlvMatch),
+                intlv_addr(end - 1, mem_range.masks,
+                           mem_range.intlvMatch) + 1,
+                masks = mem_range.masks,
+                intlvMatch = mem_range.intlvMatch)
+
+    cnt_border, mac_border, mt_borders = secure_mem_borders(sec_ctrl)
+
+    def create_cache(size, assoc, tree):
+        cache = MetaCache()
+        if size is not None:
+            cache.size = size
+        if assoc is not None:
+            cache.assoc = assoc
+        cache.set_indexing(getattr(options, "sec_meta_indexing", "modulo"))
+        if tree and getattr(options, "sec_level_aware", False):
+            cache.replacement_policy = LevelAwareRP(
+                    indexing_policy = cache.tags.indexing_policy,
+                    tree_borders = mt_borders)
+            if interleaved:
+                cache.replacement_policy.mem_range = mem_range
+            weight = getattr(options, "sec_level_weight", None)
+            if weight is not None:
+                cache.replacement_policy.level_weight = weight
+        return cache
+
+    if getattr(options, "sec_meta_caches", "shared") == "shared":
+        cache = create_cache(getattr(options, "sec_meta_cache_size", None),
+                             getattr(options, "sec_meta_cache_assoc", None),
+                             True)
+        if getattr(options, "sec_shadow_cache", False):
+            sec_ctrl.shadow_cache_size = cache.size
+        return [cache]
+
+    regions = [
+        ("counter", cnt_border, mac_border, False),
+        ("mac", mac_border, mt_borders[0], False),
+        ("tree", mt_borders[0], mt_borders[-1], True),
+    ]
+    caches = []
+    for kind, start, end, tree in regions:
+        # Inline MACs leave no MAC region
+        if start == end:
+            continue
+        cache = create_cache(
+                getattr(options, "sec_%s_cache_size" % kind, None),
+                getattr(options, "sec_%s_cache_assoc" % kind, None),
+                tree)
+        cache.addr_ranges = [cache_range(start, end)]
+        caches.append(cache)
+    return caches
+
+def config_sec_channel(options, channel, sec_ctrl, xbar, mem_ctrl,
+                       mem_range=None):
+    """
+    Insert a secure memory controller, with its metadata caches, between
+    the crossbar and the memory controller of a channel. mem_range is
+    the range of the channel if the memory is interleaved.
+
+    The per channel crossbar only sees the single stripe of its memory
+    controller, which AddrRange keeps as it is when merging.
+    """
+
+    channel.sec_bus = SystemXBar()
+
+    channel.sec_ctrl = sec_ctrl
+
+    meta_caches = create_meta_caches(options, sec_ctrl, mem_range)
+
+    channel.sec_ctrl.cpu_side_port = xbar.mem_side_ports
+
+    if len(meta_caches) == 1:
+        channel.meta_cache = meta_caches[0]
+
+        channel.sec_ctrl.meta_port = channel.meta_cache.cpu_side
+
+        meta_mem_side = channel.meta_cache.mem_side
+    else:
+        # Route every kind of metadata to its own cache, which is free
+        # as the caches are picked by a few address bits
+        channel.meta_caches = meta_caches
+
+        channel.meta_bus = NoncoherentXBar(width = 64,
+                frontend_latency = 0, forward_latency = 0,
+                response_latency = 0)
+        channel.meta_mem_bus = NoncoherentXBar(width = 64,
+                frontend_latency = 0, forward_latency = 0,
+                response_latency = 0)
+
+        channel.sec_ctrl.meta_port = channel.meta_bus.cpu_side_ports
+        for cache in meta_caches:
+            cache.cpu_side = channel.meta_bus.mem_side_ports
+            cache.mem_side = channel.meta_mem_bus.cpu_side_ports
+
+        meta_mem_side = channel.meta_mem_bus.mem_side_ports
+
+    # Lazy tree updates need to see the evictions of the metadata cache
+    if getattr(options, "sec_lazy_tree", False):
+        channel.sec_ctrl.evict_side_port = meta_mem_side
+        meta_mem_port = channel.sec_ctrl.evict_mem_port
+    else:
+        meta_mem_port = meta_mem_side
+
+    channel.sec_bus.cpu_side_ports = [
+            meta_mem_port,
+            channel.sec_ctrl.mem_port
+            ]
+
+    mem_ctrl.port = channel.sec_bus.mem_side_ports
+
 def config_mem(options, system):
     """
     Create the memory controllers based on the options and attach them.
@@ -151,34 +504,56 @@ def config_mem(options, system):
     # range of workloads.
     intlv_size = max(opt_mem_channels_intlv, system.cache_line_size.value)
 
-    nvm_intf = create_mem_intf(n_intf, system.mem_ranges[0], 0,
-        intlv_bits, intlv_size, opt_xor_low_bit)
-
-    # Set the number of ranks based on the command-line
-    # options if it was explicitly set
-    if issubclass(n_intf, m5.objects.NVMInterface) and \
-       opt_nvm_ranks:
-        nvm_intf.ranks_per_channel = opt_nvm_ranks
-
-    mem_ctrl = m5.objects.MemCtrl()
-    mem_ctrl.nvm = nvm_intf
-
-    # Insert SecCtrl between xbar and mem ctrl
-    subsystem.sec_bus = SystemXBar()
-
-    subsystem.sec_ctrl = SecCtrl()
-
-    subsystem.meta_cache = MetaCache()
-
-    subsystem.sec_ctrl.cpu_side_port = xbar.mem_side_ports
-
-    subsystem.sec_ctrl.meta_port = subsystem.meta_cache.cpu_side
-
-    subsystem.sec_bus.cpu_side_ports = [
-            subsystem.meta_cache.mem_side,
-            subsystem.sec_ctrl.mem_port
-            ]
-
-    mem_ctrl.port = subsystem.sec_bus.mem_side_ports
-
-    subsystem.mem_ctrls = [mem_ctrl]
+    # The system sees only the protected data. Every channel has its own
+    # secure memory controller, which keeps the metadata of its share of
+    # the data right after it in the same channel.
+    data_range = system.mem_ranges[0]
+    channel_data_size = data_range.size() // nbr_mem_ctrls
+
+    mem_size = secure_mem_size(create_sec_ctrl(options, channel_data_size))
+    if nbr_mem_ctrls > 1:
+        # Keep the channels in step with any interleaving granularity
+        mem_size = (mem_size + 0xfffff) // 0x100000 * 0x100000
+    mem_range = m5.objects.AddrRange(data_range.start,
+                                     size = mem_size * nbr_mem_ctrls)
+
+    if nbr_mem_ctrls > 1:
+        channels = [SubSystem() for i in range(nbr_mem_ctrls)]
+        subsystem.sec_channels = channels
+    else:
+        # A single channel keeps its objects right in the subsystem
+        channels = [subsystem]
+
+    mem_ctrls = []
+    for i, channel in enumerate(channels):
+        nvm_intf = create_mem_intf(n_intf, mem_range, i,
+            intlv_bits, intlv_size, opt_xor_low_bit)
+
+        # Set the number of ranks based on the command-line
+        # options if it was explicitly set
+        if issubclass(n_intf, m5.objects.NVMInterface) and \
+           opt_nvm_ranks:
+            nvm_intf.ranks_per_channel = opt_nvm_ranks
+
+        mem_ctrl = m5.objects.MemCtrl()
+        mem_ctrl.nvm = nvm_intf
+        mem_ctrls.append(mem_ctrl)
+
+        sec_ctrl = create_sec_ctrl(options, channel_data_size)
+        if nbr_mem_ctrls > 1:
+            # Interleave the data like the channel memory
+            sec_ctrl.data_ranges = [m5.objects.AddrRange(data_range.start,
+                    size = data_range.size(),
+                    masks = nvm_intf.range.masks,
+                    intlvMatch = i)]
+            if sec_ctrl.meta_trace_file != "":
+                sec_ctrl.meta_trace_file = "channel%d.%s" % \
+                    (i, sec_ctrl.meta_trace_file)
+            if sec_ctrl.timeline_file != "":
+                sec_ctrl.timeline_file = "channel%d.%s" % \
+                    (i, sec_ctrl.timeline_file)
+
+        config_sec_channel(options, channel, sec_ctrl, xbar, mem_ctrl,
+                           nvm_intf.range if nbr_mem_ctrls > 1 else None)
+
+    subsystem.mem_ctrls = mem_ctrls
@@ -0,0 +1,136 @@
+# Synthetic traffic benchmark of the secure memory path
+#
+# A traffic generator drives the memory through a CommMonitor, which
+# measures the bandwidth and latency seen by the requestor. With
+# --insecure the same memory is built without SecCtrl as a baseline.
+#
+# "gem5.opt configs/csh/bench.py --pattern=random --read-percent=100"
+
+import argparse
+import os
+import sys
+
+import m5
+from m5.objects import *
+from m5.util import addToPath, convert, fatal
+
+addToPath('../')
+
+from common import MemConfig
+from common import ObjectList
+from csh import SecMemConfig
+from csh.bench_suite import parse_stats, summarize, format_summary
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--pattern", default="linear",
+                    choices=["linear", "random", "strided"],
+                    help = "address pattern of the traffic")
+parser.add_argument("--read-percent", type=int, default=100,
+                    help = "percentage of reads, 0 for write only")
+parser.add_argument("--footprint", type=str, default="16MiB",
+                    help = "bytes of memory the traffic goes over")
+parser.add_argument("--rate", type=float, default=4.0,
+                    help = "injection rate in GB/s")
+parser.add_argument("--duration", type=str, default="100us",
+                    help = "simulated time of the traffic")
+parser.add_argument("--block-size", type=int, default=64,
+                    help = "bytes per request")
+parser.add_argument("--stride", type=int, default=4096,
+                    help = "bytes between accesses of the strided pattern")
+parser.add_argument("--insecure", action="store_true",
+                    help = "leave SecCtrl out for a baseline")
+parser.add_argument("--mem-size", type=str, default="1GiB",
+                    help = "size of the protected memory")
+parser.add_argument("--mem-channels", type=int, default=1,
+                    help = "number of memory channels")
+parser.add_argument("--nvm-type", default="NVM_2400_1x64",
+                    choices=ObjectList.mem_list.get_names(),
+                    help = "type of NVM to use")
+parser.add_argument("--nvm-ranks", type=int, default=1,
+                    help = "Number of ranks to iterate across")
+parser.add_argument("--sys-clock", type=str, default="1GHz",
+                    help = "clock of the memory bus")
+parser.add_argument("--list-patterns", action="store_true",
+                    help = "print the patterns this gem5 supports and exit")
+SecMemConfig.add_sec_options(parser)
+
+args = parser.parse_args()
+
+def has_strided():
+    """Whether the traffic generator of this gem5 can make strides"""
+
+    return any(getattr(export, "name", None) == "createStrided"
+               for export in getattr(PyTrafficGen, "cxx_exports", []))
+
+if args.list_patterns:
+    patterns = ["linear", "random"] + (["strided"] if has_strided() else [])
+    print("Patterns: %s" % " ".join(patterns))
+    sys.exit(0)
+
+if not 0 <= args.read_percent <= 100:
+    fatal("--read-percent must be between 0 and 100")
+if args.rate <= 0:
+    fatal("--rate must be positive")
+
+footprint = convert.toMemorySize(args.footprint)
+mem_size = convert.toMemorySize(args.mem_size)
+if footprint > mem_size:
+    fatal("--footprint of %s does not fit --mem-size of %s" %
+          (args.footprint, args.mem_size))
+if footprint < args.block_size:
+    fatal("--footprint must hold at least one block")
+
+system = System(mem_mode = 'timing',
+                mem_ranges = [AddrRange(args.mem_size)],
+                cache_line_size = args.block_size)
+
+system.voltage_domain = VoltageDomain()
+system.clk_domain = SrcClockDomain(clock = args.sys_clock,
+                                   voltage_domain = system.voltage_domain)
+
+system.membus = SystemXBar()
+system.system_port = system.membus.cpu_side_ports
+
+# Finer latency bins for the tail latency
+system.tgen = PyTrafficGen()
+system.monitor = CommMonitor(latency_bins = 100)
+system.tgen.port = system.monitor.cpu_side_port
+system.monitor.mem_side_port = system.membus.cpu_side_ports
+
+if args.insecure:
+    MemConfig.config_mem(args, system)
+else:
+    SecMemConfig.config_mem(args, system)
+
+root = Root(full_system = False, system = system)
+
+m5.instantiate()
+
+duration = m5.ticks.fromSeconds(convert.anyToLatency(args.duration))
+period = m5.ticks.fromSeconds(args.block_size / (args.rate * 1e9))
+
+def traffic(tgen):
+    if args.pattern == "linear":
+        yield tgen.createLinear(duration, 0, footprint, args.block_size,
+                                period, period, args.read_percent, 0)
+    elif args.pattern == "random":
+        yield tgen.createRandom(duration, 0, footprint, args.block_size,
+                                period, period, args.read_percent, 0)
+    else:
+        if not hasattr(tgen, "createStrided"):
+            fatal("This gem5 has no strided traffic generator")
+        yield tgen.createStrided(duration, 0, footprint, args.block_size,
+                                 args.stride, 0, period, period,
+                                 args.read_percent, 0)
+    yield tgen.createExit(0)
+
+system.tgen.start(traffic(system.tgen))
+
+exit_event = m5.simulate()
+m5.stats.dump()
+
+print("Exiting @ tick %i because %s" %
+      (m5.curTick(), exit_event.getCause()))
+
+stats = parse_stats(os.path.join(m5.options.outdir, "stats.txt"))
+print(format_summary(summarize(stats)))
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+# Run the synthetic traffic benchmark over a matrix of patterns,
+# footprints and injection rates, with and without SecCtrl
+#
+# "python3 configs/csh/bench_suite.py --gem5=./gem5/build/RISCV/gem5.opt"
+#
+# The stats helpers are also used by bench.py to summarise a single run,
+# so this file must not import m5.
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+PATTERNS = ["linear", "random", "strided"]
+
+# Read percentage of each traffic mix
+MIXES = {"read": 100, "write": 0, "mixed": 67}
+
+FOOTPRINTS = ["1MiB", "16MiB", "256MiB"]
+
+# Injection rates in GB/s
+RATES = [2.0, 8.0]
+
+QUICK_FOOTPRINTS = ["16MiB"]
+QUICK_RATES = [4.0]
+
+FIELDS = ["bandwidth", "readLatency", "readLatencyP99", "amplification"]
+
+def parse_stats(path):
+    """
+    Read the first dump of a stats.txt into a dict of stat names to
+    values. Histogram buckets are kept under their "name::lo-hi" names.
+    """
+
+    stats = {}
+    started = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith("---------- Begin"):
+                started = True
+                continue
+            if line.startswith("---------- End"):
+                if started:
+                    break
+                continue
+
+            fields = line.split()
+            if not started or len(fields) < 2:
+                continue
+            try:
+                stats[fields[0]] = float(fields[1])
+            except ValueError:
+                # Not a number, e.g. nan of an empty formula
+                pass
+
+    if not stats:
+        raise ValueError("No stats found in %s" % path)
+
+    return stats
+
+def find_stat(stats, suffix, default=0.0):
+    """Sum of the stats whose names end with suffix"""
+
+    values = [v for k, v in stats.items() if k.endswith(suffix)]
+    return sum(values) if values else default
+
+def hist_percentile(stats, suffix, fraction):
+    """
+    Upper edge of the histogram bucket reaching the given fraction of
+    the samples, the maximum sample if only the overflows reach it.
+    """
+
+    samples = find_stat(stats, suffix + "::samples")
+    if samples == 0:
+        return 0.0
+
+    bucket = re.compile(re.escape(suffix) + r"::(\d+)(?:-(\d+))?$")
+    buckets = []
+    for name, count in stats.items():
+        m = bucket.search(name)
+        if m:
+            low = int(m.group(1))
+            high = int(m.group(2)) if m.group(2) else low
+            buckets.append((low, high, count))
+
+    seen = find_stat(stats, suffix + "::underflows")
+    for low, high, count in sorted(buckets):
+        seen += count
+        if seen >= samples * fraction:
+            return float(high + 1)
+
+    return find_stat(stats, suffix + "::max_value")
+
+def summarize(stats):
+    """
+    Bandwidth in GB/s and read latencies in ns seen by the requestor,
+    and the bytes the memory controllers moved on top of the data per
+    data byte. The metadata served by the caches of SecCtrl is not
+    counted, so the baseline stays close to 0.
+    """
+
+    seconds = find_stat(stats, "simSeconds")
+    ticks_per_ns = find_stat(stats, "simFreq", 1e12) / 1e9
+
+    data_bytes = find_stat(stats, ".monitor.totalReadBytes") + \
+        find_stat(stats, ".monitor.totalWrittenBytes")
+    mem_bytes = find_stat(stats, ".bytesReadSys") + \
+        find_stat(stats, ".bytesWrittenSys")
+    meta_bytes = max(mem_bytes - data_bytes, 0.0)
+
+    hist = ".monitor.readLatencyHist"
+    return {
+        "bandwidth": data_bytes / seconds / 1e9 if seconds else 0.0,
+        "readLatency": find_stat(stats, hist + "::mean") / ticks_per_ns,
+        "readLatencyP99":
+            hist_percentile(stats, hist, 0.99) / ticks_per_ns,
+        "amplification": meta_bytes / data_bytes if data_bytes else 0.0,
+    }
+
+def format_summary(summary):
+    return ("Bandwidth %.3f GB/s, read latency %.1f ns (p99 %.1f ns), "
+            "metadata amplification %.3f" %
+            tuple(summary[field] for field in FIELDS))
+
+def run_name(pattern, mix, footprint, rate):
+    return "%s-%s-%s-%gGBps" % (pattern, mix, footprint, rate)
+
+def run_one(args, run, secure):
+    name, pattern, mix, footprint, rate = run
+    outdir = os.path.join(args.outdir, "secure" if secure else "insecure",
+                          name)
+    os.makedirs(outdir, exist_ok=True)
+
+    cmd = [args.gem5, "-re", "-d", outdir, args.config,
+           "--pattern=%s" % pattern,
+           "--read-percent=%d" % MIXES[mix],
+           "--footprint=%s" % footprint,
+           "--rate=%g" % rate,
+           "--duration=%s" % args.duration]
+    if not secure:
+        cmd.append("--insecure")
+    cmd += args.extra
+
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    try:
+        if result.returncode != 0:
+            raise RuntimeError("exit code %d" % result.returncode)
+        return summarize(parse_stats(os.path.join(outdir, "stats.txt")))
+    except (RuntimeError, OSError, ValueError) as e:
+        # A failed run leaves its cell empty, the others go on
+        print("%s %s failed (%s), see %s/simerr" %
+              (name, "secure" if secure else "insecure", e, outdir),
+              file=sys.stderr)
+        return None
+
+def supported_patterns(args):
+    """
+    Patterns the traffic generator of the gem5 binary supports, e.g.
+    strides are missing from older ones.
+    """
+
+    outdir = os.path.join(args.outdir, "probe")
+    os.makedirs(outdir, exist_ok=True)
+    result = subprocess.run([args.gem5, "-d", outdir, args.config,
+                             "--list-patterns"],
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL,
+                            universal_newlines=True)
+    for line in result.stdout.splitlines():
+        if line.startswith("Patterns:"):
+            return line.split()[1:]
+
+    # Leave it to the runs to report what is wrong
+    return PATTERNS
+
+def read_reference(path):
+    reference = {}
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            if row["bandwidth"] != "failed":
+                reference[(row["run"], row["mode"])] = \
+                    float(row["bandwidth"])
+    return reference
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+
+    parser = argparse.ArgumentParser(
+        description="Secure memory synthetic traffic benchmark")
+    parser.add_argument("--gem5", default="./gem5/build/RISCV/gem5.opt",
+                        help="gem5 binary")
+    parser.add_argument("--config", default=os.path.join(here, "bench.py"),
+                        help="benchmark config run for every point")
+    parser.add_argument("--outdir", default="./m5out/bench",
+                        help="directory of the run outputs")
+    parser.add_argument("--duration", default="100us",
+                        help="simulated time of every run")
+    parser.add_argument("--quick", action="store_true",
+                        help="one footprint and rate for a fast check")
+    parser.add_argument("--secure-only", action="store_true",
+                        help="skip the baseline runs")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+                        help="runs in parallel")
+    parser.add_argument("--csv", default=None,
+                        help="results file, <outdir>/results.csv by default")
+    parser.add_argument("--reference", default=None,
+                        help="results of an earlier run to compare with")
+    parser.add_argument("--tolerance", type=float, default=5.0,
+                        help="bandwidth drop in percent below the "
+                        "reference which fails the run")
+    parser.add_argument("extra", nargs=argparse.REMAINDER,
+                        help="options after -- are passed to the config")
+    args = parser.parse_args()
+
+    if args.extra and args.extra[0] == "--":
+        args.extra = args.extra[1:]
+    if args.csv is None:
+        args.csv = os.path.join(args.outdir, "results.csv")
+
+    footprints = QUICK_FOOTPRINTS if args.quick else FOOTPRINTS
+    rates = QUICK_RATES if args.quick else RATES
+    supported = supported_patterns(args)
+    patterns = [p for p in PATTERNS if p in supported]
+    for pattern in PATTERNS:
+        if pattern not in supported:
+            print("Skipping the %s pattern, which this gem5 lacks" %
+                  pattern, file=sys.stderr)
+    runs = [(run_name(p, m, f, r), p, m, f, r) for p, m, f, r in
+            itertools.product(patterns, MIXES, footprints, rates)]
+    modes = [True] if args.secure_only else [True, False]
+
+    with ThreadPoolExecutor(max_workers=max(args.jobs, 1)) as pool:
+        futures = {(run[0], secure): pool.submit(run_one, args, run, secure)
+                   for run in runs for secure in modes}
+        results = {key: f.result() for key, f in futures.items()}
+    failures = [key for key, summary in results.items() if summary is None]
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.csv)), exist_ok=True)
+    with open(args.csv, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["run", "mode"] + FIELDS)
+        for (name, secure), summary in sorted(results.items()):
+            writer.writerow([name, "secure" if secure else "insecure"] +
+                            (["%.6g" % summary[field] for field in FIELDS]
+                             if summary else ["failed"] * len(FIELDS)))
+
+    header = "%-34s %9s %9s %7s %9s %9s %9s %6s" % (
+        "run", "base GB/s", "sec GB/s", "slowdn",
+        "base ns", "sec ns", "sec p99", "amp")
+    print(header)
+    print("-" * len(header))
+    for name, *_ in runs:
+        sec = results[(name, True)]
+        base = results.get((name, False))
+        if sec is None:
+            print("%-34s %9s" % (name, "failed"))
+            continue
+        if base is None:
+            print("%-34s %9s %9.3f %7s %9s %9.1f %9.1f %6.3f" % (
+                name, "-", sec["bandwidth"], "-", "-",
+                sec["readLatency"], sec["readLatencyP99"],
+                sec["amplification"]))
+            continue
+        slowdown = base["bandwidth"] / sec["bandwidth"] \
+            if sec["bandwidth"] else float("inf")
+        print("%-34s %9.3f %9.3f %7.2f %9.1f %9.1f %9.1f %6.3f" % (
+            name, base["bandwidth"], sec["bandwidth"], slowdown,
+            base["readLatency"], sec["readLatency"],
+            sec["readLatencyP99"], sec["amplification"]))
+    print("Results written to %s" % args.csv)
+    if failures:
+        print("%d of %d runs failed" % (len(failures), len(results)),
+              file=sys.stderr)
+
+    if args.reference is None:
+        return 1 if failures else 0
+
+    regressions = 0
+    for key, bandwidth in sorted(read_reference(args.reference).items()):
+        if results.get(key) is None:
+            continue
+        now = results[key]["bandwidth"]
+        if now < bandwidth * (1 - args.tolerance / 100):
+            print("Regression: %s %s at %.3f GB/s, was %.3f GB/s" %
+                  (key[0], key[1], now, bandwidth), file=sys.stderr)
+            regressions += 1
+
+    return 1 if regressions or failures else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -85,6 +85,7 @@ parser.add_argument("--nvm-type", default="NVM_2400_1x64",
                     help = "type of NVM to use")
 parser.add_argument("--nvm-ranks", type=int, default=1,
                     help = "Number of ranks to iterate across")
+SecMemConfig.add_sec_options(parser)
 
 if '--ruby' in sys.argv:
     Ruby.define_options(parser)
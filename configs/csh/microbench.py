@@ -0,0 +1,112 @@
+# Host speed microbenchmark of SecCtrl
+#
+# A traffic generator pushes a fixed number of requests through SecCtrl
+# and its metadata cache into a stub memory answering right away, so that
+# the host time is spent in the controller model. The result is the
+# number of simulated requests per host second.
+#
+# "gem5.opt configs/csh/microbench.py --requests=2000000"
+
+import argparse
+import os
+import time
+
+import m5
+from m5.objects import *
+from m5.util import addToPath, convert, fatal
+
+addToPath('../')
+
+from csh import SecMemConfig
+from csh.bench_suite import parse_stats, find_stat
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--requests", type=int, default=2000000,
+                    help = "requests pushed through the controller")
+parser.add_argument("--pattern", default="random",
+                    choices=["linear", "random"],
+                    help = "address pattern of the requests")
+parser.add_argument("--read-percent", type=int, default=67,
+                    help = "percentage of reads")
+parser.add_argument("--footprint", type=str, default="64MiB",
+                    help = "bytes of memory the requests go over")
+parser.add_argument("--block-size", type=int, default=64,
+                    help = "bytes per request")
+parser.add_argument("--sys-clock", type=str, default="1GHz",
+                    help = "clock of the memory bus")
+SecMemConfig.add_sec_options(parser)
+
+args = parser.parse_args()
+
+if args.requests <= 0:
+    fatal("--requests must be positive")
+
+system = System(mem_mode = 'timing',
+                mem_ranges = [AddrRange(args.footprint)],
+                cache_line_size = args.block_size)
+
+system.voltage_domain = VoltageDomain()
+system.clk_domain = SrcClockDomain(clock = args.sys_clock,
+                                   voltage_domain = system.voltage_domain)
+
+system.membus = SystemXBar()
+system.system_port = system.membus.cpu_side_ports
+
+system.tgen = PyTrafficGen()
+system.tgen.port = system.membus.cpu_side_ports
+
+sec_ctrl = SecMemConfig.create_sec_ctrl(args, system.mem_ranges[0].size())
+
+# The stub memory takes no time worth mentioning on the host nor in the
+# simulation, and never rejects a request
+system.stub_mem = SimpleMemory(
+        range = AddrRange(0, size = SecMemConfig.secure_mem_size(sec_ctrl)),
+        latency = '1ns', latency_var = '0ns', bandwidth = '1024GiB/s')
+
+SecMemConfig.config_sec_channel(args, system, sec_ctrl, system.membus,
+                                system.stub_mem)
+
+root = Root(full_system = False, system = system)
+
+m5.instantiate()
+
+# Requests go out every cycle, the controller pushing back when it is
+# full. The data limit ends the traffic long before the duration.
+period = m5.ticks.fromSeconds(convert.anyToLatency(args.sys_clock))
+duration = period * args.requests * 1000
+footprint = system.mem_ranges[0].size()
+data_limit = args.requests * args.block_size
+
+def traffic(tgen):
+    if args.pattern == "linear":
+        yield tgen.createLinear(duration, 0, footprint, args.block_size,
+                                period, period, args.read_percent,
+                                data_limit)
+    else:
+        yield tgen.createRandom(duration, 0, footprint, args.block_size,
+                                period, period, args.read_percent,
+                                data_limit)
+    yield tgen.createExit(0)
+
+system.tgen.start(traffic(system.tgen))
+
+start = time.time()
+exit_event = m5.simulate()
+host_seconds = time.time() - start
+m5.stats.dump()
+
+print("Exiting @ tick %i because %s" %
+      (m5.curTick(), exit_event.getCause()))
+
+stats = parse_stats(os.path.join(m5.options.outdir, "stats.txt"))
+requests = find_stat(stats, ".sec_ctrl.readReqs") + \
+    find_stat(stats, ".sec_ctrl.writeReqs")
+
+print("%d requests in %.2f host seconds, %.0f requests per host second, "
+      "%.2f events per request" %
+      (requests, host_seconds, requests / host_seconds,
+       find_stat(stats, ".sec_ctrl.eventsPerRequest")))
+if args.sec_host_profile:
+    print("Host time per request %.0f ns, per response %.0f ns" %
+          (find_stat(stats, ".sec_ctrl.hostTimePerRequest") * 1e9,
+           find_stat(stats, ".sec_ctrl.hostTimePerResponse") * 1e9))
@@ -0,0 +1,22 @@
+from m5.params import *
+from m5.objects.ClockedObject import ClockedObject
+
+class CryptoEngine(ClockedObject):
+    type = 'CryptoEngine'
+    cxx_header = "csh/crypto_engine.hh"
+    cxx_class = 'gem5::CryptoEngine'
+
+    aes_units = Param.Unsigned(1, "Pipelined AES units generating pads")
+    hash_units = Param.Unsigned(1, "Pipelined units hashing tree nodes")
+    mac_units = Param.Unsigned(1, "Pipelined units computing MACs")
+
+    aes_latency = Param.Cycles(40, "Latency of generating a pad")
+    hash_latency = Param.Cycles(80, "Latency of hashing a tree node")
+    mac_latency = Param.Cycles(80, "Latency of computing a MAC")
+    compare_latency = Param.Cycles(1,
+            "Latency of the XOR with the pad and the MAC compare")
+
+    initiation_interval = Param.Cycles(1,
+            "Cycles between two operations entering the same unit")
+    queue_depth = Param.Unsigned(32,
+            "Operations that may wait for a unit before requests stall")
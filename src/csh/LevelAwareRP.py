@@ -0,0 +1,18 @@
+from m5.params import *
+from m5.objects.ReplacementPolicies import LRURP
+
+class LevelAwareRP(LRURP):
+    type = 'LevelAwareRP'
+    cxx_header = "csh/level_aware_rp.hh"
+    cxx_class = 'gem5::replacement_policy::LevelAware'
+
+    indexing_policy = Param.BaseIndexingPolicy(
+            "Indexing policy of the cache, to find the address of a block")
+    tree_borders = VectorParam.Addr([], "Start of every stored Merkle "
+            "Tree level, followed by the end of the tree, in the address "
+            "space of the secure memory controller")
+    mem_range = Param.AddrRange(AllMemory, "Interleaved range of the "
+            "channel the cache is in, whose bits are removed from the "
+            "block addresses before comparing them with the borders")
+    level_weight = Param.Latency('100ns', "Time a tree node is kept as "
+            "more recently used per level")
@@ -0,0 +1,35 @@
+from m5.params import *
+from m5.SimObject import SimObject
+
+class MetaPrefetcher(SimObject):
+    type = 'MetaPrefetcher'
+    abstract = True
+    cxx_header = "csh/meta_prefetcher.hh"
+    cxx_class = 'gem5::MetaPrefetcher'
+
+    block_size = Param.Unsigned(64, "Size of a data block")
+    degree = Param.Unsigned(2, "Data blocks predicted per access")
+    distance = Param.Unsigned(16, "Data blocks between an access and the "
+            "first block predicted from it, rounded up to whole strides by "
+            "the stride prefetcher")
+    tracked_blocks = Param.Unsigned(1024, "Prefetched metadata blocks "
+            "remembered to filter duplicates and to find the useful ones")
+
+class StrideMetaPrefetcher(MetaPrefetcher):
+    type = 'StrideMetaPrefetcher'
+    cxx_header = "csh/meta_prefetcher.hh"
+    cxx_class = 'gem5::StrideMetaPrefetcher'
+
+    confidence_threshold = Param.Unsigned(2, "Repetitions of a stride of "
+            "a requestor before it is prefetched")
+
+class StreamMetaPrefetcher(MetaPrefetcher):
+    type = 'StreamMetaPrefetcher'
+    cxx_header = "csh/meta_prefetcher.hh"
+    cxx_class = 'gem5::StreamMetaPrefetcher'
+
+    num_streams = Param.Unsigned(8, "Streams tracked at the same time")
+    window = Param.Unsigned(4, "Blocks an access may skip and still "
+            "advance a stream")
+    train_accesses = Param.Unsigned(2, "Accesses advancing a stream "
+            "before it is prefetched")
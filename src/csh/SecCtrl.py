@@ -1,7 +1,26 @@
 from m5.params import *
-from m5.SimObject import SimObject
+from m5.objects.ClockedObject import ClockedObject
+from m5.objects.CryptoEngine import CryptoEngine
+from m5.objects.MetaPrefetcher import MetaPrefetcher
 
-class SecCtrl(SimObject):
+class SecCounterMode(Enum):
+    vals = [
+        'monolithic', # one counter_size bit counter per data block
+        'split',      # a major counter and 64 counter_size bit minors
+                      # per counter block
+        'morphable',  # a major counter and 128 compressed minors per
+                      # counter block
+    ]
+
+class SecCounterEncoding(Enum):
+    vals = [
+        'uniform',    # 3 bits for each of the 128 minors
+        'zcc',        # zero counter compression, the non-zero minors
+                      # share the bits left by a 128 bit bitmap
+        'adaptive',   # morph between both as the minors grow
+    ]
+
+class SecCtrl(ClockedObject):
     type = 'SecCtrl'
     cxx_header = "csh/sec_ctrl.hh"
     cxx_class = 'gem5::SecCtrl'
@@ -9,3 +28,72 @@ class SecCtrl(SimObject):
     cpu_side_port = ResponsePort("CPU side port")
     mem_port = RequestPort("Memory side port")
     meta_port = RequestPort("Memory side port")
+    evict_side_port = ResponsePort("Memory side of the metadata cache, "
+            "needed by lazy tree updates")
+    evict_mem_port = RequestPort("Passes the metadata cache traffic on "
+            "to memory")
+
+    num_transactions = Param.Unsigned(16,
+            "Number of secure transactions that can be in flight")
+
+    # Geometry of the protected memory. The metadata is placed right
+    # after the protected data in the order counters, MACs, tree levels.
+    data_size = Param.MemorySize('8GiB', "Size of the protected data")
+    data_ranges = VectorParam.AddrRange([], "Interleaved range of the "
+            "protected data when the memory behind is one of several "
+            "channels, which then holds the metadata of its data_size "
+            "bytes only")
+    counter_mode = Param.SecCounterMode('monolithic',
+            "Layout of the encryption counters")
+    counter_size = Param.Unsigned(0, "Bits per encryption counter, or per "
+            "minor counter in split mode, 0 for 7 in split mode and 8 "
+            "otherwise")
+    counter_encoding = Param.SecCounterEncoding('adaptive',
+            "Encoding of the minors in morphable mode")
+    mac_size = Param.Unsigned(16, "Bytes of MAC per data block")
+    mac_inline = Param.Bool(False, "Carry the MAC in the ECC or side-band "
+            "bits of its data block instead of a MAC region")
+    # The memory behind only sees the data block of an inline MAC access,
+    # so the extra bursts are charged as latency here and their bytes
+    # only count in the metadata bytes of SecCtrl
+    mac_burst_latency = Param.Cycles(4, "Extra cycles to transfer an "
+            "inline MAC with its data block")
+    tree_arity = Param.Unsigned(8, "Children per Merkle Tree node, up to "
+            "128 for a tree of morphable counter blocks")
+    tree_levels = Param.Unsigned(0, "Merkle Tree levels including the "
+            "on-chip root, 0 derives the minimum from data_size")
+
+    lazy_tree_updates = Param.Bool(False, "Only dirty written counters "
+            "and nodes in the metadata cache, and rehash their parents "
+            "when they are evicted")
+    pinned_levels = Param.Unsigned(0, "Top stored tree levels kept in "
+            "on-chip SRAM, where every tree walk stops")
+    pinned_latency = Param.Cycles(2, "Latency of reading or updating a "
+            "pinned tree node")
+    tree_fetch_window = Param.Unsigned(1, "Tree levels a read walk fetches "
+            "ahead of knowing it needs them, 1 fetches one level after "
+            "another and 0 all stored levels at once")
+    shadow_cache_size = Param.MemorySize('0', "Capacity of a fully "
+            "associative LRU cache the metadata misses are compared with "
+            "to count conflict misses, 0 disables it")
+    speculation_window = Param.Unsigned(0, "Read responses which may be "
+            "sent before their verification finishes, 0 disables "
+            "speculation")
+    meta_trace_file = Param.String("", "File in the output directory "
+            "getting a binary record of every metadata access, gzipped if "
+            "it ends in .gz, empty disables tracing")
+    timeline_file = Param.String("", "File in the output directory "
+            "getting the timeline of every transaction as Chrome trace "
+            "event JSON, empty disables it")
+    write_buffer_size = Param.Unsigned(0, "Writes acknowledged as soon "
+            "as they are buffered, with their verification drained in the "
+            "background, 0 disables the buffer")
+    write_high_thresh_perc = Param.Percent(85, "Write buffer occupancy "
+            "above which writes drain even while reads are in flight")
+    host_profile = Param.Bool(False, "Measure the host time spent "
+            "handling requests and responses")
+
+    crypto = Param.CryptoEngine(CryptoEngine(),
+            "Units hashing tree nodes, computing MACs and generating pads")
+    prefetcher = Param.MetaPrefetcher(NULL, "Prefetcher of the counters "
+            "and MACs of upcoming data blocks")
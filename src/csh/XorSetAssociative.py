@@ -0,0 +1,6 @@
+from m5.objects.IndexingPolicies import SetAssociative
+
+class XorSetAssociative(SetAssociative):
+    type = 'XorSetAssociative'
+    cxx_class = 'gem5::XorSetAssociative'
+    cxx_header = "csh/xor_set_assoc.hh"
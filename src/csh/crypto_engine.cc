@@ -0,0 +1,155 @@
+#include "csh/crypto_engine.hh"
+
+#include <algorithm>
+
+#include "base/intmath.hh"
+#include "base/trace.hh"
+#include "debug/CryptoEngine.hh"
+
+namespace gem5
+{
+
+CryptoEngine::CryptoEngine(const CryptoEngineParams &p) :
+    ClockedObject(p),
+    initiationInterval(p.initiation_interval),
+    compareCycles(p.compare_latency),
+    queueDepth(p.queue_depth),
+    stats(*this)
+{
+    fatal_if(p.aes_units == 0 || p.hash_units == 0 || p.mac_units == 0,
+             "CryptoEngine needs at least one unit of each kind");
+    fatal_if(initiationInterval == 0,
+             "initiation_interval must be at least one cycle");
+
+    issueSlots[Aes].resize(p.aes_units);
+    issueSlots[Hash].resize(p.hash_units);
+    issueSlots[Mac].resize(p.mac_units);
+
+    latencies[Aes] = p.aes_latency;
+    latencies[Hash] = p.hash_latency;
+    latencies[Mac] = p.mac_latency;
+}
+
+void
+CryptoEngine::updateQueue()
+{
+    waiting.erase(waiting.begin(), waiting.upper_bound(curTick()));
+}
+
+Tick
+CryptoEngine::firstFreeSlot(const std::set<Tick> &slots, Tick edge) const
+{
+    Tick ii = cyclesToTicks(initiationInterval);
+
+    // Skip the operations overlapping the candidate interval until a
+    // gap is long enough
+    Tick start = edge;
+    auto it = start >= ii ? slots.upper_bound(start - ii) : slots.begin();
+    for (; it != slots.end() && *it < start + ii; ++it) {
+        start = std::max(start, *it + ii);
+    }
+
+    return start;
+}
+
+Tick
+CryptoEngine::reserve(Op op, Tick ready)
+{
+    // Operations enter the units on an edge of our clock
+    Tick period = clockPeriod();
+    Tick edge = divCeil(std::max(ready, curTick()), period) * period;
+    Tick ii = cyclesToTicks(initiationInterval);
+
+    // Take the unit which can start the operation first
+    std::set<Tick> *unit = nullptr;
+    Tick start = MaxTick;
+    for (auto &slots : issueSlots[op]) {
+        // Operations done issuing no longer block anything
+        while (!slots.empty() && *slots.begin() + ii <= curTick()) {
+            slots.erase(slots.begin());
+        }
+
+        Tick unit_start = firstFreeSlot(slots, edge);
+        if (unit_start < start) {
+            start = unit_start;
+            unit = &slots;
+        }
+    }
+    unit->insert(start);
+
+    updateQueue();
+
+    stats.ops[op]++;
+    if (start > edge) {
+        waiting.insert(start);
+
+        stats.queuedOps[op]++;
+        stats.queueingTicks[op] += start - edge;
+    }
+    stats.queueOccupancy.sample(waiting.size());
+
+    DPRINTF(CryptoEngine, "Op %d ready at %d starts at %d\n",
+            op, ready, start);
+
+    return start + cyclesToTicks(latencies[op]);
+}
+
+bool
+CryptoEngine::full()
+{
+    updateQueue();
+
+    return waiting.size() >= queueDepth;
+}
+
+Tick
+CryptoEngine::nextFreeTick()
+{
+    assert(full());
+
+    // Room is made when the first waiting operation starts
+    return *waiting.begin() + 1;
+}
+
+CryptoEngine::CryptoEngineStats::CryptoEngineStats(CryptoEngine &engine)
+    : statistics::Group(&engine),
+
+    ADD_STAT(ops, statistics::units::Count::get(),
+             "Operations executed per kind"),
+    ADD_STAT(queuedOps, statistics::units::Count::get(),
+             "Operations which waited for a unit per kind"),
+    ADD_STAT(queueingTicks, statistics::units::Tick::get(),
+             "Ticks operations waited for a unit per kind"),
+    ADD_STAT(avgQueueingTicks, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average ticks an operation waited for a unit per kind"),
+    ADD_STAT(queueOccupancy, statistics::units::Count::get(),
+             "Operations waiting for a unit when one is reserved")
+{
+}
+
+void
+CryptoEngine::CryptoEngineStats::regStats()
+{
+    using namespace statistics;
+
+    statistics::Group::regStats();
+
+    const char *op_names[] = { "aes", "hash", "mac" };
+
+    ops.init(NumOps);
+    queuedOps.init(NumOps);
+    queueingTicks.init(NumOps);
+    for (int i=0; i<NumOps; i++) {
+        ops.subname(i, op_names[i]);
+        queuedOps.subname(i, op_names[i]);
+        queueingTicks.subname(i, op_names[i]);
+    }
+
+    avgQueueingTicks.flags(nozero | nonan);
+    avgQueueingTicks = queueingTicks / ops;
+
+    queueOccupancy.init(16);
+}
+
+} // namespace gem5
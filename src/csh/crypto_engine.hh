@@ -0,0 +1,123 @@
+#ifndef __CSH_CRYPTO_ENGINE_HH__
+#define __CSH_CRYPTO_ENGINE_HH__
+
+#include <array>
+#include <set>
+#include <vector>
+
+#include "base/statistics.hh"
+#include "params/CryptoEngine.hh"
+#include "sim/clocked_object.hh"
+
+namespace gem5
+{
+
+/**
+ * Crypto engine of the secure memory controller. It has a finite number
+ * of pipelined AES, hash and MAC units in its own clock domain, so
+ * operations of concurrent transactions contend for them.
+ */
+class CryptoEngine : public ClockedObject
+{
+  public:
+
+    enum Op
+    {
+        Aes,
+        Hash,
+        Mac,
+        NumOps
+    };
+
+  private:
+
+    /**
+     * Per operation and unit, the start ticks of the reserved operations
+     * which still block the unit for an initiation interval. A calendar
+     * lets an operation ready early fill a gap before one reserved
+     * further ahead.
+     */
+    std::array<std::vector<std::set<Tick>>, NumOps> issueSlots;
+
+    std::array<Cycles, NumOps> latencies;
+
+    const Cycles initiationInterval;
+
+    const Cycles compareCycles;
+
+    const unsigned queueDepth;
+
+    /**
+     * Start ticks of the reserved operations that had to wait for a
+     * unit, i.e. the occupancy of the queue
+     */
+    std::multiset<Tick> waiting;
+
+    /**
+     * Drop the waiting operations which have started by now.
+     */
+    void updateQueue();
+
+    /**
+     * First tick from a clock edge on a unit is free for an initiation
+     * interval.
+     */
+    Tick firstFreeSlot(const std::set<Tick> &slots, Tick edge) const;
+
+    struct CryptoEngineStats : public statistics::Group
+    {
+        CryptoEngineStats(CryptoEngine &engine);
+
+        void regStats() override;
+
+        statistics::Vector ops;
+        statistics::Vector queuedOps;
+        statistics::Vector queueingTicks;
+        statistics::Formula avgQueueingTicks;
+
+        statistics::Histogram queueOccupancy;
+    };
+
+    CryptoEngineStats stats;
+
+  public:
+
+    /**
+     * Constructor
+     */
+    CryptoEngine(const CryptoEngineParams &p);
+
+    /**
+     * Reserve a slot for an operation whose inputs are ready at a tick.
+     *
+     * @param op kind of operation
+     * @param ready tick the inputs of the operation are ready
+     * @return tick the result of the operation is available
+     */
+    Tick reserve(Op op, Tick ready);
+
+    /**
+     * Latency of an operation without any contention.
+     */
+    Tick latency(Op op) const { return cyclesToTicks(latencies[op]); }
+
+    /**
+     * Latency of the XOR with the pad and the MAC compare, which are
+     * done by simple logic besides the units.
+     */
+    Tick compareLatency() const { return cyclesToTicks(compareCycles); }
+
+    /**
+     * Whether the queue is full, so that no new work should be started.
+     */
+    bool full();
+
+    /**
+     * Tick the queue will have room again, only valid if it is full.
+     */
+    Tick nextFreeTick();
+};
+
+} // namespace gem5
+
+#endif // __CSH_CRYPTO_ENGINE_HH__
@@ -0,0 +1,71 @@
+#include "csh/level_aware_rp.hh"
+
+#include <algorithm>
+#include <cassert>
+
+#include "mem/cache/cache_blk.hh"
+#include "mem/cache/tags/indexing_policies/base.hh"
+#include "params/LevelAwareRP.hh"
+
+namespace gem5
+{
+
+namespace replacement_policy
+{
+
+LevelAware::LevelAware(const Params &p) :
+    LRU(p),
+    indexingPolicy(p.indexing_policy),
+    treeBorders(p.tree_borders),
+    memRange(p.mem_range),
+    levelWeight(p.level_weight)
+{
+    fatal_if(!std::is_sorted(treeBorders.begin(), treeBorders.end()),
+             "tree_borders must be in ascending order");
+}
+
+unsigned
+LevelAware::level(Addr addr) const
+{
+    if (memRange.interleaved()) addr = memRange.removeIntlvBits(addr);
+
+    auto it = std::upper_bound(treeBorders.begin(), treeBorders.end(),
+                               addr);
+
+    // Below the tree or past its end
+    if (it == treeBorders.begin() || it == treeBorders.end()) return 0;
+
+    return it - treeBorders.begin();
+}
+
+ReplaceableEntry *
+LevelAware::getVictim(const ReplacementCandidates &candidates) const
+{
+    // There must be at least one replacement candidate
+    assert(candidates.size() > 0);
+
+    ReplaceableEntry *victim = nullptr;
+    Tick victim_tick = MaxTick;
+    for (const auto &candidate : candidates) {
+        Tick tick = std::static_pointer_cast<LRUReplData>(
+                    candidate->replacementData)->lastTouchTick;
+
+        // Invalid blocks were reset to tick 0 and have no level
+        auto blk = dynamic_cast<const CacheBlk *>(candidate);
+        if (blk != nullptr && blk->isValid()) {
+            tick += level(indexingPolicy->regenerateAddr(blk->getTag(),
+                                                         blk)) *
+                levelWeight;
+        }
+
+        if (victim == nullptr || tick < victim_tick) {
+            victim = candidate;
+            victim_tick = tick;
+        }
+    }
+
+    return victim;
+}
+
+} // namespace replacement_policy
+} // namespace gem5
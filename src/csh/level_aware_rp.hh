@@ -0,0 +1,71 @@
+#ifndef __CSH_LEVEL_AWARE_RP_HH__
+#define __CSH_LEVEL_AWARE_RP_HH__
+
+#include <vector>
+
+#include "base/addr_range.hh"
+#include "mem/cache/replacement_policies/lru_rp.hh"
+
+namespace gem5
+{
+
+class BaseIndexingPolicy;
+
+struct LevelAwareRPParams;
+
+namespace replacement_policy
+{
+
+/**
+ * LRU replacement for a metadata cache, where a tree node is kept as if
+ * it had been touched later the higher its level is. A node near the
+ * root covers much more data than a counter or MAC, so it is worth
+ * more of the cache.
+ */
+class LevelAware : public LRU
+{
+  private:
+
+    /**
+     * Indexing policy of the cache, which turns the tag of a block back
+     * into its address
+     */
+    const BaseIndexingPolicy *indexingPolicy;
+
+    /// Start of every stored tree level, the last one is the tree end
+    const std::vector<Addr> treeBorders;
+
+    /// Channel of an interleaved memory, the borders are channel-local
+    const AddrRange memRange;
+
+    /// Ticks a node is considered more recently used per level
+    const Tick levelWeight;
+
+    /**
+     * Level of the block at an address, 0 for anything but tree nodes
+     * and the first tree level at 1.
+     */
+    unsigned level(Addr addr) const;
+
+  public:
+
+    typedef LevelAwareRPParams Params;
+
+    LevelAware(const Params &p);
+
+    /**
+     * Find the candidate with the lowest last touch tick after the
+     * bonus of its level, invalid entries first.
+     *
+     * @param candidates Replacement candidates, selected by indexing
+     *        policy.
+     * @return Replacement entry to be replaced.
+     */
+    ReplaceableEntry *getVictim(
+            const ReplacementCandidates &candidates) const override;
+};
+
+} // namespace replacement_policy
+} // namespace gem5
+
+#endif // __CSH_LEVEL_AWARE_RP_HH__
@@ -0,0 +1,229 @@
+#include "csh/meta_prefetcher.hh"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "base/intmath.hh"
+#include "base/logging.hh"
+#include "base/trace.hh"
+#include "debug/MetaPrefetcher.hh"
+
+namespace gem5
+{
+
+MetaPrefetcher::MetaPrefetcher(const MetaPrefetcherParams &p) :
+    SimObject(p),
+    blockSize(p.block_size),
+    degree(p.degree),
+    distance(p.distance),
+    trackedCapacity(p.tracked_blocks),
+    stats(*this)
+{
+    fatal_if(blockSize == 0, "block_size must not be 0");
+    fatal_if(trackedCapacity == 0, "tracked_blocks must not be 0");
+}
+
+void
+MetaPrefetcher::notify(Addr addr, RequestorID requestorId,
+                       std::vector<Addr> &addrs)
+{
+    size_t first = addrs.size();
+    calculatePrefetch(addr, requestorId, addrs);
+
+    stats.predictions += addrs.size() - first;
+}
+
+bool
+MetaPrefetcher::untrack(Addr blk)
+{
+    auto it = trackedIndex.find(blk);
+    if (it == trackedIndex.end()) return false;
+
+    trackedBlocks.erase(it->second);
+    trackedIndex.erase(it);
+
+    return true;
+}
+
+bool
+MetaPrefetcher::track(Addr blk)
+{
+    if (trackedIndex.count(blk) != 0) return false;
+
+    if (trackedBlocks.size() == trackedCapacity) {
+        trackedIndex.erase(trackedBlocks.back());
+        trackedBlocks.pop_back();
+    }
+
+    trackedBlocks.push_front(blk);
+    trackedIndex.emplace(blk, trackedBlocks.begin());
+
+    DPRINTF(MetaPrefetcher, "Prefetching metadata block %#x\n", blk);
+
+    stats.issued++;
+
+    return true;
+}
+
+void
+MetaPrefetcher::prefetchDone(Addr blk, bool hit, unsigned size)
+{
+    if (!hit) {
+        stats.bytesFetched += size;
+    } else if (untrack(blk)) {
+        // The cache held the block anyway
+        stats.redundant++;
+    }
+}
+
+void
+MetaPrefetcher::demandAccess(Addr blk, bool hit)
+{
+    if (untrack(blk) && hit) {
+        DPRINTF(MetaPrefetcher, "Prefetched block %#x was useful\n", blk);
+
+        stats.useful++;
+    } else if (!hit) {
+        stats.demandMisses++;
+    }
+}
+
+MetaPrefetcher::MetaPrefetcherStats::MetaPrefetcherStats(MetaPrefetcher &pf)
+    : statistics::Group(&pf),
+
+    ADD_STAT(predictions, statistics::units::Count::get(),
+             "Data blocks predicted"),
+    ADD_STAT(issued, statistics::units::Count::get(),
+             "Metadata blocks prefetched"),
+    ADD_STAT(redundant, statistics::units::Count::get(),
+             "Prefetches which hit in the metadata cache"),
+    ADD_STAT(useful, statistics::units::Count::get(),
+             "Prefetched blocks later hit by a demand access"),
+    ADD_STAT(demandMisses, statistics::units::Count::get(),
+             "Demand counter and MAC accesses missing in the metadata "
+             "cache"),
+    ADD_STAT(accuracy, statistics::units::Ratio::get(),
+             "Fraction of the prefetches filling the cache which were "
+             "useful"),
+    ADD_STAT(coverage, statistics::units::Ratio::get(),
+             "Fraction of the demand misses removed by prefetching"),
+    ADD_STAT(bytesFetched, statistics::units::Byte::get(),
+             "Bytes of metadata read from memory by prefetches")
+{
+}
+
+void
+MetaPrefetcher::MetaPrefetcherStats::regStats()
+{
+    using namespace statistics;
+
+    statistics::Group::regStats();
+
+    accuracy.flags(nozero | nonan);
+    accuracy = useful / (issued - redundant);
+
+    coverage.flags(nozero | nonan);
+    coverage = useful / (useful + demandMisses);
+}
+
+StrideMetaPrefetcher::StrideMetaPrefetcher(
+        const StrideMetaPrefetcherParams &p) :
+    MetaPrefetcher(p),
+    confidenceThreshold(p.confidence_threshold)
+{
+}
+
+void
+StrideMetaPrefetcher::calculatePrefetch(Addr addr, RequestorID requestorId,
+                                        std::vector<Addr> &addrs)
+{
+    auto it = strides.find(requestorId);
+    if (it == strides.end()) {
+        strides.emplace(requestorId, StrideEntry{addr, 0, 0});
+        return;
+    }
+
+    StrideEntry &entry = it->second;
+    int64_t stride = addr - entry.lastAddr;
+    entry.lastAddr = addr;
+
+    if (stride == 0) return;
+
+    if (stride == entry.stride) {
+        if (entry.confidence < confidenceThreshold) entry.confidence++;
+    } else {
+        entry.stride = stride;
+        entry.confidence = 0;
+        return;
+    }
+
+    if (entry.confidence < confidenceThreshold) return;
+
+    // Enough strides to be distance data blocks ahead, at least one
+    uint64_t span = std::abs(stride);
+    int64_t ahead = std::max<uint64_t>(
+        divCeil(uint64_t(distance) * blockSize, span), 1);
+
+    for (unsigned i=0; i<degree; i++) {
+        addrs.push_back(addr + stride * (ahead + i));
+    }
+}
+
+StreamMetaPrefetcher::StreamMetaPrefetcher(
+        const StreamMetaPrefetcherParams &p) :
+    MetaPrefetcher(p),
+    window(p.window),
+    trainAccesses(p.train_accesses),
+    streams(p.num_streams, Stream{0, 0, 0, 0}),
+    useCount(0)
+{
+    fatal_if(streams.empty(), "num_streams must not be 0");
+}
+
+void
+StreamMetaPrefetcher::calculatePrefetch(Addr addr, RequestorID requestorId,
+                                        std::vector<Addr> &addrs)
+{
+    Addr blk = addr / blockSize;
+    useCount++;
+
+    Stream *match = nullptr;
+    Stream *victim = &streams.front();
+    for (auto &stream : streams) {
+        int64_t delta = blk - stream.lastBlk;
+
+        // Nothing new about a block the stream is at
+        if (stream.accesses > 0 && delta == 0) return;
+
+        // A new stream may still go either way
+        bool ahead = stream.direction == 0 ?
+            delta != 0 : delta * stream.direction > 0;
+
+        if (stream.accesses > 0 && ahead &&
+            std::abs(delta) <= (int64_t)window) {
+            match = &stream;
+            break;
+        }
+
+        if (stream.lastUse < victim->lastUse) victim = &stream;
+    }
+
+    if (match == nullptr) {
+        *victim = Stream{blk, 0, 1, useCount};
+        return;
+    }
+
+    match->direction = blk > match->lastBlk ? 1 : -1;
+    match->lastBlk = blk;
+    match->accesses++;
+    match->lastUse = useCount;
+
+    if (match->accesses < trainAccesses) return;
+
+    for (unsigned i=0; i<degree; i++) {
+        Addr next = blk + match->direction * int64_t(distance + i);
+        addrs.push_back(next * blockSize);
+    }
+}
+
+} // namespace gem5
@@ -0,0 +1,170 @@
+#ifndef __CSH_META_PREFETCHER_HH__
+#define __CSH_META_PREFETCHER_HH__
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "base/statistics.hh"
+#include "base/types.hh"
+#include "mem/request.hh"
+#include "params/MetaPrefetcher.hh"
+#include "params/StreamMetaPrefetcher.hh"
+#include "params/StrideMetaPrefetcher.hh"
+#include "sim/sim_object.hh"
+
+namespace gem5
+{
+
+/**
+ * Prefetcher of the secure memory controller. It watches the data
+ * addresses the controller verifies and predicts upcoming data blocks,
+ * whose metadata the controller then fetches into the metadata cache.
+ * It also remembers the prefetched metadata blocks to drop duplicates
+ * and to tell how useful the prefetches were.
+ */
+class MetaPrefetcher : public SimObject
+{
+  protected:
+    const unsigned blockSize;
+
+    /// Blocks predicted per access, and how far ahead of it
+    const unsigned degree;
+    const unsigned distance;
+
+    /**
+     * Predict the data blocks following an access.
+     *
+     * @param addr address of the accessed data
+     * @param requestorId requestor of the access
+     * @param addrs predicted data addresses are appended to it
+     */
+    virtual void calculatePrefetch(Addr addr, RequestorID requestorId,
+                                   std::vector<Addr> &addrs) = 0;
+
+  private:
+    /**
+     * Prefetched metadata blocks not demanded yet, most recently
+     * prefetched first.
+     */
+    const size_t trackedCapacity;
+    std::list<Addr> trackedBlocks;
+    std::unordered_map<Addr, std::list<Addr>::iterator> trackedIndex;
+
+    /**
+     * Forget a tracked block.
+     *
+     * @return whether the block was tracked
+     */
+    bool untrack(Addr blk);
+
+    struct MetaPrefetcherStats : public statistics::Group
+    {
+        MetaPrefetcherStats(MetaPrefetcher &pf);
+
+        void regStats() override;
+
+        statistics::Scalar predictions;
+        statistics::Scalar issued;
+        statistics::Scalar redundant;
+        statistics::Scalar useful;
+        statistics::Scalar demandMisses;
+        statistics::Formula accuracy;
+        statistics::Formula coverage;
+        statistics::Scalar bytesFetched;
+    };
+
+    MetaPrefetcherStats stats;
+
+  public:
+
+    MetaPrefetcher(const MetaPrefetcherParams &p);
+
+    /**
+     * Observe a data access and predict the blocks following it.
+     */
+    void notify(Addr addr, RequestorID requestorId,
+                std::vector<Addr> &addrs);
+
+    /**
+     * Remember a metadata block before prefetching it.
+     *
+     * @param blk metadata block number
+     * @return false if the block was prefetched already
+     */
+    bool track(Addr blk);
+
+    /**
+     * Account a prefetch response, a hit means the metadata cache held
+     * the block already.
+     */
+    void prefetchDone(Addr blk, bool hit, unsigned size);
+
+    /**
+     * Account a demand access to a metadata block, which is useful if
+     * a prefetch brought the block in.
+     */
+    void demandAccess(Addr blk, bool hit);
+};
+
+/**
+ * Per requestor stride detection. A stride seen often enough in a row
+ * is prefetched.
+ */
+class StrideMetaPrefetcher : public MetaPrefetcher
+{
+  private:
+    struct StrideEntry
+    {
+        Addr lastAddr;
+        int64_t stride;
+        unsigned confidence;
+    };
+
+    const unsigned confidenceThreshold;
+
+    std::unordered_map<RequestorID, StrideEntry> strides;
+
+  protected:
+    void calculatePrefetch(Addr addr, RequestorID requestorId,
+                           std::vector<Addr> &addrs) override;
+
+  public:
+    StrideMetaPrefetcher(const StrideMetaPrefetcherParams &p);
+};
+
+/**
+ * Stream detection over data blocks. Accesses slightly ahead of the
+ * last block of a stream advance it, no matter the requestor, and a
+ * trained stream is prefetched in its direction.
+ */
+class StreamMetaPrefetcher : public MetaPrefetcher
+{
+  private:
+    struct Stream
+    {
+        Addr lastBlk;
+        int direction;
+        unsigned accesses;
+        /// For replacing the least recently advanced stream
+        uint64_t lastUse;
+    };
+
+    const unsigned window;
+    const unsigned trainAccesses;
+
+    std::vector<Stream> streams;
+    uint64_t useCount;
+
+  protected:
+    void calculatePrefetch(Addr addr, RequestorID requestorId,
+                           std::vector<Addr> &addrs) override;
+
+  public:
+    StreamMetaPrefetcher(const StreamMetaPrefetcherParams &p);
+};
+
+} // namespace gem5
+
+#endif // __CSH_META_PREFETCHER_HH__
@@ -0,0 +1,119 @@
+#include "csh/sec_counters.hh"
+
+#include <algorithm>
+
+namespace gem5
+{
+
+/**
+ * A morphable counter block keeps 384 bits for the minor counters, next
+ * to the major counter, the format and the MAC. The uniform format gives
+ * each of the 128 counters 3 bits, the zero counter compressed format
+ * spends 128 bits on a non-zero bitmap and shares the rest among the
+ * non-zero counters.
+ */
+static const unsigned morphMinorBits = 384;
+static const unsigned morphCounters = SecLayout::morphCounters;
+static const unsigned morphMaxZccWidth = 16;
+
+SecCounters::SecCounters(const SecLayout &layout, Encoding _encoding) :
+    mode(layout.counterMode()),
+    encoding(_encoding),
+    counterSize(layout.counterSize()),
+    cntsPerBlock(layout.cntsPerBlock())
+{
+}
+
+SecCounters::Update
+SecCounters::increment(Addr pktAddr)
+{
+    if (mode == SecLayout::Monolithic) return Incremented;
+
+    Addr blk = pktAddr / NODE_SPACE;
+    Addr cnt_blk = blk / cntsPerBlock;
+
+    auto it = _blocks.find(cnt_blk);
+    if (it == _blocks.end()) {
+        it = _blocks.emplace(cnt_blk,
+                Block{0, std::vector<uint16_t>(cntsPerBlock, 0),
+                      encoding == Zcc}).first;
+    }
+    Block &counters = it->second;
+
+    uint16_t &minor = counters.minors[blk % cntsPerBlock];
+    if (minor < UINT16_MAX) {
+        minor++;
+
+        bool reencoded = false;
+        if (encode(counters, reencoded)) {
+            return reencoded ? Reencoded : Incremented;
+        }
+    }
+
+    // Minor counter overflow
+    counters.major++;
+    std::fill(counters.minors.begin(), counters.minors.end(), 0);
+    counters.minors[blk % cntsPerBlock] = 1;
+    counters.zcc = encoding == Zcc;
+
+    return Overflowed;
+}
+
+bool
+SecCounters::fitsUniform(const Block &counters)
+{
+    const unsigned width = morphMinorBits / morphCounters;
+
+    for (auto minor : counters.minors) {
+        if (minor >= (1 << width)) return false;
+    }
+
+    return true;
+}
+
+bool
+SecCounters::fitsZcc(const Block &counters)
+{
+    unsigned non_zero = 0;
+    uint16_t max_minor = 0;
+    for (auto minor : counters.minors) {
+        if (minor != 0) non_zero++;
+        max_minor = std::max(max_minor, minor);
+    }
+
+    if (non_zero == 0) return true;
+
+    unsigned width = std::min((morphMinorBits - morphCounters) / non_zero,
+                              morphMaxZccWidth);
+
+    return width == morphMaxZccWidth || max_minor < (1 << width);
+}
+
+bool
+SecCounters::encode(Block &counters, bool &reencoded) const
+{
+    if (mode == SecLayout::Split) {
+        return counters.minors.empty() ||
+            *std::max_element(counters.minors.begin(),
+                              counters.minors.end()) <
+            (1 << counterSize);
+    }
+
+    if (counters.zcc ? fitsZcc(counters) : fitsUniform(counters)) {
+        return true;
+    }
+
+    if (encoding != Adaptive) return false;
+
+    // Morph into the other format if the counters fit it
+    if (counters.zcc ? fitsUniform(counters) : fitsZcc(counters)) {
+        counters.zcc = !counters.zcc;
+        reencoded = true;
+
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace gem5
@@ -0,0 +1,100 @@
+#ifndef __CSH_SEC_COUNTERS_HH__
+#define __CSH_SEC_COUNTERS_HH__
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "csh/sec_layout.hh"
+
+namespace gem5
+{
+
+/**
+ * Encryption counters of the written data blocks, deciding when a minor
+ * counter overflows. It does not depend on gem5, so that the standalone
+ * replay tool counts overflows the same way as SecCtrl.
+ */
+class SecCounters
+{
+  public:
+
+    enum Encoding
+    {
+        Uniform,
+        Zcc,
+        Adaptive
+    };
+
+    /**
+     * Counter values of a counter block in split or morphable mode.
+     */
+    struct Block
+    {
+        uint64_t major;
+        std::vector<uint16_t> minors;
+        /// Morphable block is zero counter compressed, else uniform
+        bool zcc;
+    };
+
+    /// What a write did to the counters of its block
+    enum Update
+    {
+        Incremented,
+        /// A morphable block switched to the other format
+        Reencoded,
+        /// The major counter was incremented, the blocks covered must
+        /// be re-encrypted
+        Overflowed
+    };
+
+  private:
+    const SecLayout::CounterMode mode;
+    const Encoding encoding;
+    const unsigned counterSize;
+    const unsigned cntsPerBlock;
+
+    /// Counter blocks written so far, indexed by counter block
+    std::unordered_map<Addr, Block> _blocks;
+
+    /**
+     * Whether the minor counters of a morphable block can be encoded in
+     * the uniform or the zero counter compressed format.
+     */
+    static bool fitsUniform(const Block &counters);
+    static bool fitsZcc(const Block &counters);
+
+    /**
+     * Whether the minor counters still fit the counter block, switching
+     * the format of a morphable block if needed.
+     */
+    bool encode(Block &counters, bool &reencoded) const;
+
+  public:
+
+    SecCounters(const SecLayout &layout, Encoding encoding);
+
+    /**
+     * Increment the counter of the written block. On a minor counter
+     * overflow the major counter is incremented and the minors reset.
+     * Monolithic counters are assumed never to overflow.
+     */
+    Update increment(Addr pktAddr);
+
+    /// Counter blocks written so far, indexed by counter block
+    const std::unordered_map<Addr, Block> &blocks() const { return _blocks; }
+
+    /**
+     * Restore the counters, e.g. from a checkpoint.
+     */
+    void clear() { _blocks.clear(); }
+    void
+    setBlock(Addr cntBlk, const Block &block)
+    {
+        _blocks[cntBlk] = block;
+    }
+};
+
+} // namespace gem5
+
+#endif // __CSH_SEC_COUNTERS_HH__
@@ -1,57 +1,306 @@
 #include "csh/sec_ctrl.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
 #include "base/trace.hh"
+#include "debug/Drain.hh"
 #include "debug/SecCtrl.hh"
+#include "sim/core.hh"
 #include "sim/system.hh"
 
 namespace gem5
 {
 
-SecCtrl::SecCtrl(const SecCtrlParams &p) :
-    SimObject(p),
-    readVerFinished([this]{ processReadVerFinished(); }, name()),
-    sendMacWrite([this]{ processSendMacWrite(); }, name()),
-    sendNextMtWrite([this]{ processSendNextMtWrite(); }, name()),
-    writeVerFinished([this]{ processWriteVerFinished(); }, name()),
-    cpuSidePort(name() + ".cpu_side_port", this),
-    memPort(name() + ".mem_port", this),
-    metaPort(name() + ".meta_port", this),
-    state(Idle),
-    chargeTime(0),
+/**
+ * Trace records buffered before they are written out.
+ */
+static const size_t traceBufferRecords = 4096;
+
+/**
+ * Bytes of timeline events buffered before they are written out.
+ */
+static const size_t timelineBufferBytes = 1 << 16;
+
+/**
+ * Tracks of a transaction entry on the timeline, followed by a fetch and
+ * a hash track per stored tree level.
+ */
+enum TimelineTrack
+{
+    TxnTrack,
+    DataTrack,
+    CounterTrack,
+    MacTrack,
+    CounterHashTrack,
+    TreeTracks
+};
+
+static const char *const timelineTrackNames[] =
+    { "transaction", "data", "counter", "mac", "counter hash" };
+
+/**
+ * Adds the host time spent in its scope to a stat, if it got one.
+ */
+class HostTimer
+{
+  private:
+    statistics::Scalar *total;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    HostTimer(statistics::Scalar *_total) : total(_total)
+    {
+        if (total != nullptr) start = std::chrono::steady_clock::now();
+    }
+
+    ~HostTimer()
+    {
+        if (total == nullptr) return;
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        *total += elapsed.count();
+    }
+};
+
+/**
+ * The layout of the metadata protecting the data of a controller.
+ */
+static SecLayout::Params
+layoutParams(const SecCtrlParams &p)
+{
+    SecLayout::Params params;
+    params.dataSize = p.data_size;
+    switch (p.counter_mode) {
+        case enums::split:
+            params.counterMode = SecLayout::Split;
+            break;
+        case enums::morphable:
+            params.counterMode = SecLayout::Morphable;
+            break;
+        default:
+            params.counterMode = SecLayout::Monolithic;
+            break;
+    }
+    params.counterSize = p.counter_size;
+    params.macSize = p.mac_size;
+    params.macInline = p.mac_inline;
+    params.treeArity = p.tree_arity;
+    params.treeLevels = p.tree_levels;
+    params.pinnedLevels = p.pinned_levels;
+
+    return params;
+}
+
+/**
+ * The encoding of the morphable counter blocks of a controller.
+ */
+static SecCounters::Encoding
+counterEncoding(const SecCtrlParams &p)
+{
+    switch (p.counter_encoding) {
+        case enums::uniform:
+            return SecCounters::Uniform;
+        case enums::zcc:
+            return SecCounters::Zcc;
+        default:
+            return SecCounters::Adaptive;
+    }
+}
+
+SecCtrl::Transaction::Transaction(SecCtrl *ctrl, uint16_t _id) :
+    id(_id),
+    valid(false), isRead(false),
+    seq(0),
     verifiedPktAddr(0),
     verifiedCntOffs(0),
     flags(0), requestorId(0),
     needsResponse(true),
-    cntBorder(0), macBorder(0), mtBorders{0},
+    chargeTime(0),
+    startTime(0),
+    issueTime(0),
+    padTime(0), macTime(0),
+    macDone(false),
+    posted(false),
+    forwardTime(0), forwarded(false),
     responsePkt(nullptr), counterPkt(nullptr), macPkt(nullptr),
-    mtPkts{nullptr}
+    mtPkts(ctrl->mtLevel-1, nullptr),
+    mtIssued(0), mtVerified(0),
+    mtReadPending(false),
+    forwardData([this, ctrl]{ ctrl->processForwardData(*this); },
+                ctrl->name() + ".forwardData"),
+    readVerFinished([this, ctrl]{ ctrl->processReadVerFinished(*this); },
+                    ctrl->name() + ".readVerFinished"),
+    sendMacWrite([this, ctrl]{ ctrl->processSendMacWrite(*this); },
+                 ctrl->name() + ".sendMacWrite"),
+    sendNextMtWrite([this, ctrl]{ ctrl->processSendNextMtWrite(*this); },
+                    ctrl->name() + ".sendNextMtWrite"),
+    writeVerFinished([this, ctrl]{ ctrl->processWriteVerFinished(*this); },
+                     ctrl->name() + ".writeVerFinished")
+{
+}
+
+void
+SecCtrl::Transaction::reset()
+{
+    valid = false;
+    forwarded = false;
+    macDone = false;
+    posted = false;
+    // The metadata packets must have gone back to the pool
+    responsePkt = nullptr;
+    counterPkt = nullptr;
+    macPkt = nullptr;
+    std::fill(mtPkts.begin(), mtPkts.end(), nullptr);
+    mtIssued = 0;
+    mtVerified = 0;
+    mtReadPending = false;
+}
+
+SecCtrl::SecCtrl(const SecCtrlParams &p) :
+    ClockedObject(p),
+    cpuSidePort(name() + ".cpu_side_port", this),
+    memPort(name() + ".mem_port", this),
+    metaPort(name() + ".meta_port", this),
+    evictSidePort(name() + ".evict_side_port", this),
+    evictMemPort(name() + ".evict_mem_port", this),
+    dataSpace(p.data_size),
+    dataRanges(p.data_ranges),
+    layout(layoutParams(p)),
+    cntsPerBlock(0),
+    macSize(p.mac_size),
+    macInline(p.mac_inline),
+    macBurstLatency(p.mac_burst_latency),
+    mtArity(p.tree_arity),
+    mtLevel(0),
+    pinnedLevels(p.pinned_levels),
+    pinnedLevel(0),
+    pinnedLatency(p.pinned_latency),
+    treeFetchWindow(p.tree_fetch_window),
+    nextTxnSeq(0),
+    numOrphanFetches(0),
+    crypto(p.crypto),
+    prefetcher(p.prefetcher),
+    cntBorder(0), macBorder(0),
+    shadowCapacity(p.shadow_cache_size / NODE_SPACE),
+    counters(layout, counterEncoding(p)),
+    numBackgroundPkts(0),
+    lazyTreeUpdates(p.lazy_tree_updates),
+    treeUpdateEvent([this]{ processTreeUpdates(); }, name()),
+    speculationWindow(p.speculation_window),
+    numUnverified(0),
+    writeBufferSize(p.write_buffer_size),
+    writeHighThresh(std::max(1u,
+                writeBufferSize * p.write_high_thresh_perc / 100)),
+    readStalled(false),
+    numActiveReads(0),
+    bufferRespEvent([this]{ processBufferResponses(); }, name()),
+    traceStream(nullptr),
+    timelineStream(nullptr),
+    timelineTracks(0),
+    rejectStartTick(0),
+    cryptoRetryEvent([this]{ processCryptoRetry(); }, name()),
+    hostProfile(p.host_profile),
+    stats(*this)
 {
     DPRINTF(SecCtrl, "Constructing\n");
 
-    // Calculate each space border
-    cntBorder = DATA_SPACE;
+    fatal_if(!layout.error().empty(), "%s", layout.error());
+
+    cntsPerBlock = layout.cntsPerBlock();
+    cntBorder = layout.cntBorder();
+    macBorder = layout.macBorder();
+    mtBorders = layout.mtBorders();
+    mtLevel = layout.mtLevel();
+    pinnedLevel = layout.pinnedLevel();
+
+    fatal_if(dataRanges.size() > 1, "Only one data range is supported");
+    fatal_if(!dataRanges.empty() && (dataRanges.front().start() != 0 ||
+                                     dataRanges.front().size() != dataSpace),
+             "data_ranges must start at 0 and hold data_size bytes");
+
+    if (!p.meta_trace_file.empty()) {
+        traceStream = simout.create(p.meta_trace_file, true);
+        traceBuffer.reserve(traceBufferRecords);
+
+        static_assert(sizeof(MetaTraceRecord) == 32,
+                      "Trace records must not have padding");
+        const MetaTraceHeader header =
+            { {'S', 'E', 'C', 'M', 'E', 'T', 'A', '\0'}, 1,
+              sizeof(MetaTraceRecord) };
+        traceStream->stream()->write(
+                reinterpret_cast<const char *>(&header), sizeof(header));
+
+        // Nothing is destroyed at the end of the simulation
+        registerExitCallback([this]{ flushTrace(); });
+    }
 
-    macBorder = cntBorder + DATA_SPACE / 64;
+    fatal_if(p.num_transactions == 0,
+             "SecCtrl needs at least one transaction entry");
 
-    for (uint8_t i=0; i<MT_LEVEL; i++) {
-        mtBorders[i] = macBorder + DATA_SPACE / 4;
+    for (uint16_t i=0; i<p.num_transactions; i++) {
+        transactions.emplace_back(new Transaction(this, i));
     }
 
-    Addr node_space = NODE_SPACE;
-    for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-        node_space *= 8;
+    // Hand out the lowest entries first
+    for (uint16_t i=p.num_transactions; i>0; i--) {
+        freeTransactions.push_back(i-1);
+    }
 
-        for (uint8_t j=0; j<=i; j++) {
-            mtBorders[MT_LEVEL-1-j] += node_space;
+    if (!p.timeline_file.empty()) {
+        timelineStream = simout.create(p.timeline_file);
+        timelineTracks = TreeTracks + 2 * (mtLevel-1);
+
+        // Name and order the tracks, the rest of the events follow
+        // with a leading comma
+        timelineBuffer = "[\n{\"name\":\"process_name\",\"ph\":\"M\","
+            "\"pid\":0,\"args\":{\"name\":\"" + name() + "\"}}";
+        for (uint16_t i=0; i<p.num_transactions; i++) {
+            for (unsigned track=0; track<timelineTracks; track++) {
+                std::string track_name = track < TreeTracks ?
+                    timelineTrackNames[track] :
+                    std::string(track % 2 == 0 ? "tree L" : "hash L") +
+                    std::to_string((track - TreeTracks) / 2);
+                unsigned tid = i * timelineTracks + track;
+
+                timelineBuffer += ",\n{\"name\":\"thread_name\","
+                    "\"ph\":\"M\",\"pid\":0,\"tid\":" +
+                    std::to_string(tid) + ",\"args\":{\"name\":\"txn " +
+                    std::to_string(i) + " " + track_name + "\"}}";
+                timelineBuffer += ",\n{\"name\":\"thread_sort_index\","
+                    "\"ph\":\"M\",\"pid\":0,\"tid\":" +
+                    std::to_string(tid) + ",\"args\":{\"sort_index\":" +
+                    std::to_string(tid) + "}}";
+            }
         }
+
+        registerExitCallback([this]{ flushTimeline(true); });
     }
 
+    DPRINTF(SecCtrl, "Counters at %#x, MACs at %#x, %d tree levels, "
+            "end at %#x\n", cntBorder, macBorder, mtLevel,
+            mtBorders.back());
+    DPRINTF(SecCtrl, "%d tree levels of %d bytes pinned on chip\n",
+            pinnedLevels, mtBorders.back() - mtBorders[pinnedLevel]);
+}
+
+SecCtrl::~SecCtrl()
+{
+    for (auto pkt : freePkts) ::operator delete(pkt);
+    for (auto data : freeBuffers) delete [] data;
 }
 
 bool
 SecCtrl::CPUSidePort::sendPacket(PacketPtr pkt)
 {
-    panic_if(blockedPacket != nullptr, "Should never try to send if blocked!");
+    // Keep the order of responses already waiting for a retry
+    if (blocked()) {
+        blockedPackets.push_back(pkt);
+
+        return false;
+    }
 
     // If we can't send the packet across the port, store it for later.
     if (sendTimingResp(pkt)) {
@@ -61,7 +310,7 @@ SecCtrl::CPUSidePort::sendPacket(PacketPtr pkt)
 
     } else {
         DPRINTF(SecCtrl, "Failed to send the packet %s\n", pkt->print());
-        blockedPacket = pkt;
+        blockedPackets.push_back(pkt);
 
         return false;
 
@@ -71,9 +320,12 @@ SecCtrl::CPUSidePort::sendPacket(PacketPtr pkt)
 void
 SecCtrl::CPUSidePort::trySendRetryReq()
 {
-    if (needRetry && blockedPacket == nullptr) {
+    if (needRetry && ctrl->canAcceptRequest()) {
         DPRINTF(SecCtrl, "Sending retry req for %d\n", id);
 
+        ctrl->stats.rejectedCycles +=
+            ctrl->ticksToCycles(curTick() - ctrl->rejectStartTick);
+
         // Only send a retry if the port is now completely free
         needRetry = false;
         sendRetryReq();
@@ -86,6 +338,12 @@ SecCtrl::CPUSidePort::getAddrRanges() const
     return ctrl->getAddrRanges();
 }
 
+Tick
+SecCtrl::CPUSidePort::recvAtomic(PacketPtr pkt)
+{
+    return ctrl->handleAtomic(pkt);
+}
+
 void
 SecCtrl::CPUSidePort::recvFunctional(PacketPtr pkt)
 {
@@ -95,15 +353,28 @@ SecCtrl::CPUSidePort::recvFunctional(PacketPtr pkt)
 bool
 SecCtrl::CPUSidePort::recvTimingReq(PacketPtr pkt)
 {
-    if (ctrl->state == Idle) {
+    if (ctrl->canAcceptRequest(pkt)) {
         DPRINTF(SecCtrl, "Got request %s\n", pkt->print());
 
-        ctrl->handleRequest(pkt);
-        return true;
+        return ctrl->handleRequest(pkt);
     } else {
         DPRINTF(SecCtrl, "Rejected request %s\n", pkt->print());
 
+        if (!needRetry) ctrl->rejectStartTick = curTick();
+        ctrl->stats.rejectedReqs++;
+
+        if (ctrl->writeBufferSize > 0 && pkt->isWrite() &&
+            ctrl->writeBuffer.size() >= ctrl->writeBufferSize) {
+            ctrl->stats.writeBufferFull++;
+        } else if (ctrl->writeBufferSize > 0 &&
+                   ctrl->findBufferedWrite(pkt) != nullptr) {
+            // Only the drained write can complete the read
+            ctrl->readStalled = true;
+            ctrl->drainWriteBuffer();
+        }
+
         needRetry = true;
+        ctrl->waitForCrypto();
         return false;
     }
 }
@@ -114,20 +385,35 @@ SecCtrl::CPUSidePort::recvRespRetry()
     DPRINTF(SecCtrl, "Received response retry\n");
 
     // We should have a blocked packet if this function is called.
-    assert(blockedPacket != nullptr);
+    assert(blocked());
 
-    // Grab the blocked packet.
-    PacketPtr pkt = blockedPacket;
-    blockedPacket = nullptr;
+    // Resend as many packets as possible. It's possible that it fails again.
+    while (blocked()) {
+        PacketPtr pkt = blockedPackets.front();
 
-    // Try to resend it. It's possible that it fails again.
-    ctrl->handleResponse(pkt);
+        if (!sendTimingResp(pkt)) {
+            DPRINTF(SecCtrl, "Failed to resend the packet %s\n",
+                    pkt->print());
+            return;
+        }
+
+        DPRINTF(SecCtrl, "Resent the packet %s\n", pkt->print());
+        blockedPackets.pop_front();
+    }
+
+    trySendRetryReq();
+    ctrl->checkDrain();
 }
 
 bool
 SecCtrl::MemSidePort::sendPacket(PacketPtr pkt)
 {
-    panic_if(blockedPacket != nullptr, "Should never try to send if blocked!");
+    // Keep the order of requests already waiting for a retry
+    if (!blockedPackets.empty()) {
+        blockedPackets.push_back(pkt);
+
+        return false;
+    }
 
     // If we can't send the packet across the port, store it for later.
     if (sendTimingReq(pkt)) {
@@ -137,7 +423,7 @@ SecCtrl::MemSidePort::sendPacket(PacketPtr pkt)
 
     } else {
         DPRINTF(SecCtrl, "Failed to send the packet %s\n", pkt->print());
-        blockedPacket = pkt;
+        blockedPackets.push_back(pkt);
 
         return false;
 
@@ -164,14 +450,21 @@ SecCtrl::MemSidePort::recvReqRetry()
     DPRINTF(SecCtrl, "Received request retry\n");
 
     // We should have a blocked packet if this function is called.
-    assert(blockedPacket != nullptr);
+    assert(!blockedPackets.empty());
 
-    // Grab the blocked packet.
-    PacketPtr pkt = blockedPacket;
-    blockedPacket = nullptr;
+    // Resend as many packets as possible. It's possible that it fails again.
+    while (!blockedPackets.empty()) {
+        PacketPtr pkt = blockedPackets.front();
 
-    // Try to resend it. It's possible that it fails again.
-    ctrl->handleRequest(pkt);
+        if (!sendTimingReq(pkt)) {
+            DPRINTF(SecCtrl, "Failed to resend the packet %s\n",
+                    pkt->print());
+            return;
+        }
+
+        DPRINTF(SecCtrl, "Resent the packet %s\n", pkt->print());
+        blockedPackets.pop_front();
+    }
 }
 
 void
@@ -180,495 +473,1609 @@ SecCtrl::MemSidePort::recvRangeChange()
     ctrl->handleRangeChange();
 }
 
-void
-SecCtrl::processReadVerFinished()
+AddrRangeList
+SecCtrl::EvictSidePort::getAddrRanges() const
 {
-    DPRINTF(SecCtrl, "Read verification is finished\n");
+    return ctrl->evictMemPort.getAddrRanges();
+}
 
-    if (cpuSidePort.sendPacket(responsePkt)) {
-        state = Idle;
-        responsePkt = nullptr;
-        counterPkt = nullptr;
-        macPkt = nullptr;
-        for (uint8_t i=0; i<MT_LEVEL-1; i++) mtPkts[i] = nullptr;
-        cpuSidePort.trySendRetryReq();
-    } else {
-        // Just wait cpuSidePort::recvReqRetry
-        // for recalling this function
-        ;
+Tick
+SecCtrl::EvictSidePort::recvAtomic(PacketPtr pkt)
+{
+    if (pkt->cmd == MemCmd::WritebackDirty) {
+        ctrl->handleEviction(pkt->getAddr(), pkt->req->requestorId(),
+                             true);
     }
 
+    return ctrl->evictMemPort.sendAtomic(pkt);
 }
 
 void
-SecCtrl::processSendMacWrite()
+SecCtrl::EvictSidePort::recvFunctional(PacketPtr pkt)
 {
-    sendMacPkt(false);
+    ctrl->evictMemPort.sendFunctional(pkt);
 }
 
-void
-SecCtrl::processSendNextMtWrite()
+bool
+SecCtrl::EvictSidePort::recvTimingReq(PacketPtr pkt)
 {
-    for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-        if (mtPkts[i] == nullptr) {
-            sendMtPkt(i, false);
+    // Look at the packet first, memory deletes a sent writeback
+    bool dirty_evict = pkt->cmd == MemCmd::WritebackDirty;
+    Addr addr = pkt->getAddr();
+    RequestorID requestor_id = pkt->req->requestorId();
 
-            return;
-        }
-    }
+    if (!ctrl->evictMemPort.sendTimingReq(pkt)) return false;
 
-    assert(false);
+    if (dirty_evict) ctrl->handleEviction(addr, requestor_id, false);
+
+    return true;
 }
 
 void
-SecCtrl::processWriteVerFinished()
+SecCtrl::EvictSidePort::recvRespRetry()
 {
-    DPRINTF(SecCtrl, "Write verification is finished\n");
-
-    if (needsResponse) {
-        if (cpuSidePort.sendPacket(responsePkt)) {
-            state = Idle;
-            responsePkt = nullptr;
-            counterPkt = nullptr;
-            macPkt = nullptr;
-            for (uint8_t i=0; i<MT_LEVEL-1; i++)
-                mtPkts[i] = nullptr;
-            cpuSidePort.trySendRetryReq();
-        } else {
-            // Just wait cpuSidePort::recvReqRetry
-            // for recalling this function
-            ;
-        }
-    } else {
-        state = Idle;
-        responsePkt = nullptr;
-        counterPkt = nullptr;
-        macPkt = nullptr;
-        for (uint8_t i=0; i<MT_LEVEL-1; i++) mtPkts[i] = nullptr;
-        cpuSidePort.trySendRetryReq();
-    }
+    ctrl->evictMemPort.sendRetryResp();
+}
 
+bool
+SecCtrl::EvictMemPort::recvTimingResp(PacketPtr pkt)
+{
+    return ctrl->evictSidePort.sendTimingResp(pkt);
 }
 
 void
-SecCtrl::updateChargeTime(Tick newChargeTime)
+SecCtrl::EvictMemPort::recvReqRetry()
 {
-    if (chargeTime < newChargeTime) {
-        chargeTime = newChargeTime;
-    }
+    ctrl->evictSidePort.sendRetryReq();
 }
 
-PacketPtr
-SecCtrl::createMetaPkt(Addr addr, unsigned size, bool isRead)
+void
+SecCtrl::EvictMemPort::recvRangeChange()
 {
-    RequestPtr req(new Request(addr, size, flags, requestorId));
+    ctrl->evictSidePort.sendRangeChange();
+}
 
-    // Select packet command
-    MemCmd cmd = isRead ? MemCmd::ReadReq : MemCmd::WriteReq;
+void
+SecCtrl::processForwardData(Transaction &txn)
+{
+    DPRINTF(SecCtrl, "Forwarding unverified data of %#x\n",
+            txn.verifiedPktAddr);
 
-    PacketPtr retPkt = new Packet(req, cmd);
+    stats.readLatency.sample(curTick() - txn.startTime);
 
-    uint8_t *reqData = new uint8_t[size]; // just empty here
-    retPkt->dataDynamic(reqData);
+    // A blocked response stays queued in cpuSidePort until the retry
+    cpuSidePort.sendPacket(txn.responsePkt);
 
-    return retPkt;
+    // The packet belongs to the CPU side now, responsePkt only tells
+    // that the data arrived
+    txn.forwardTime = curTick();
 }
 
-bool
-SecCtrl::sendCntPkt(bool isRead)
+void
+SecCtrl::processReadVerFinished(Transaction &txn)
 {
-    // Approximation
-    // Assume every block has a 8 bit counter
+    DPRINTF(SecCtrl, "Read verification of %#x is finished\n",
+            txn.verifiedPktAddr);
 
-    Addr addr =
-        cntBorder + (verifiedPktAddr >> 6);
+    if (txn.forwardData.scheduled()) {
+        // Verification caught up with the speculation
+        deschedule(txn.forwardData);
+        processForwardData(txn);
+    }
 
-    PacketPtr cntPkt = createMetaPkt(
-            addr,
-            1,
-            isRead);
+    if (timelineStream != nullptr) {
+        timelineEvent(txn, TxnTrack, "read", txn.startTime, curTick());
+        timelineEvent(txn, TxnTrack, "readVerFinished", curTick(),
+                      curTick(), true);
+    }
+
+    if (txn.forwarded) {
+        // The contents are not modelled, so the verification always
+        // succeeds and the data already sent can be committed
+        stats.verificationLag.sample(curTick() - txn.forwardTime);
 
-    return metaPort.sendPacket(cntPkt);
+        assert(numUnverified > 0);
+        numUnverified--;
+    } else {
+        stats.readLatency.sample(curTick() - txn.startTime);
+
+        // A blocked response stays queued in cpuSidePort until the retry
+        cpuSidePort.sendPacket(txn.responsePkt);
+    }
+
+    freeTransaction(txn);
 }
 
-bool
-SecCtrl::sendMacPkt(bool isRead)
+void
+SecCtrl::processSendMacWrite(Transaction &txn)
 {
-    Addr addr =
-        macBorder + (verifiedPktAddr >> 2);
-
-    PacketPtr macPkt = createMetaPkt(
-            addr >> 4 << 4,
-            16,
-            isRead);
+    assert(!macInline);
 
-    return metaPort.sendPacket(macPkt);
+    sendMacPkt(txn, false);
 }
 
-bool
-SecCtrl::sendMtPkt(uint8_t nth, bool isRead)
+void
+SecCtrl::processSendNextMtWrite(Transaction &txn)
 {
-    Addr addr =
-        mtBorders[nth] + (verifiedCntOffs >> (nth+1)*3);
+    for (uint8_t i=0; i<pinnedLevel; i++) {
+        if (txn.mtPkts[i] == nullptr) {
+            sendMtPkt(txn, i, false);
 
-    PacketPtr mtPkt = createMetaPkt(
-            isRead ? addr >> 6 << 6 : addr >> 3 << 3, // Alignment
-            isRead ? 64 : 8,
-            isRead);
+            return;
+        }
+    }
 
-    return metaPort.sendPacket(mtPkt);
+    assert(false);
 }
 
 void
-SecCtrl::handleRequest(PacketPtr pkt)
+SecCtrl::processWriteVerFinished(Transaction &txn)
 {
-    switch (state) {
-        case Idle:
-            // Store the information of the packet
+    DPRINTF(SecCtrl, "Write verification of %#x is finished\n",
+            txn.verifiedPktAddr);
 
-            // Verified Counter Offset (BMT)
-            verifiedPktAddr = pkt->getAddr();
-            verifiedCntOffs = verifiedPktAddr >> 6;
-            // Params of the packet
-            flags = pkt->req->getFlags();
-            requestorId = pkt->req->requestorId();
-            // Whether the pkt needs response or not
-            needsResponse = pkt->needsResponse();
+    stats.writeLatency.sample(curTick() - txn.startTime);
 
-            if (pkt->isRead()) {
-                state = Read;
+    if (timelineStream != nullptr) {
+        timelineEvent(txn, TxnTrack, "write", txn.startTime, curTick());
+        timelineEvent(txn, TxnTrack, "writeVerFinished", curTick(),
+                      curTick(), true);
+    }
 
-                // Coverable all failures
-                // because they are different ports
-                memPort.sendPacket(pkt);
-                sendCntPkt(true);
-                sendMacPkt(true);
-                sendMtPkt(0, true);
+    if (txn.needsResponse && txn.posted) {
+        // The copy of a buffered write, acknowledged long ago
+        delete txn.responsePkt;
+    } else if (txn.needsResponse) {
+        // A blocked response stays queued in cpuSidePort until the retry
+        cpuSidePort.sendPacket(txn.responsePkt);
+    }
 
-                return;
+    freeTransaction(txn);
+}
 
-            } else {
-                state = Write;
+void
+SecCtrl::updateChargeTime(Transaction &txn, Tick newChargeTime)
+{
+    if (txn.chargeTime < newChargeTime) {
+        txn.chargeTime = newChargeTime;
+    }
+}
 
-                // Coverable of both failures
-                // because they are different ports
-                memPort.sendPacket(pkt);
-                sendCntPkt(true);
+/**
+ * Whether the request lies entirely within the buffered write.
+ */
+static bool
+covers(PacketPtr write, PacketPtr pkt)
+{
+    return write->getAddr() <= pkt->getAddr() &&
+        pkt->getAddr() + pkt->getSize() <=
+        write->getAddr() + write->getSize();
+}
 
-                return;
-            }
+bool
+SecCtrl::canAcceptRequest() const
+{
+    if (cpuSidePort.blocked() || drainState() == DrainState::Draining) {
+        return false;
+    }
 
-        /**
-         * MemSidePort::recvReqRetry case
-         */
-        default:
-            // Resend the packet
+    return (!freeTransactions.empty() && !crypto->full()) ||
+        writeBuffer.size() < writeBufferSize;
+}
 
-            // Check if the address is valid
-            if (pkt->getAddr() == verifiedPktAddr) {
-                memPort.sendPacket(pkt);
+bool
+SecCtrl::canAcceptRequest(PacketPtr pkt) const
+{
+    // Do not take new work while responses are stuck in the CPU port,
+    // which bounds the response queue by the table size
+    if (cpuSidePort.blocked() || drainState() == DrainState::Draining) {
+        return false;
+    }
 
-                return;
+    if (writeBufferSize > 0) {
+        PacketPtr write = findBufferedWrite(pkt);
+
+        if (pkt->isWrite()) {
+            // A write of the same block is merged
+            return writeBuffer.size() < writeBufferSize ||
+                (write != nullptr && write->getAddr() == pkt->getAddr() &&
+                 write->getSize() == pkt->getSize());
+        } else if (write != nullptr) {
+            // A partly overlapping write must reach memory first
+            return covers(write, pkt);
+        }
+    }
 
-            } else if (pkt->getAddr() == cntBorder + verifiedCntOffs) {
-                metaPort.sendPacket(pkt);
+    return !freeTransactions.empty() && !crypto->full();
+}
 
-                return;
+PacketPtr
+SecCtrl::findBufferedWrite(PacketPtr pkt) const
+{
+    // The newest write holds the latest data
+    for (auto it = writeBuffer.rbegin(); it != writeBuffer.rend(); ++it) {
+        PacketPtr write = it->pkt;
+        if (write->getAddr() < pkt->getAddr() + pkt->getSize() &&
+            pkt->getAddr() < write->getAddr() + write->getSize()) {
+            return write;
+        }
+    }
 
-            } else if (pkt->getAddr() == macBorder + (verifiedCntOffs << 4)) {
-                metaPort.sendPacket(pkt);
+    return nullptr;
+}
 
-                return;
-            }
+void
+SecCtrl::bufferWrite(PacketPtr pkt)
+{
+    // The requestor is done with the packet we deleted last time
+    pendingDelete.reset();
 
-            for (uint8_t i=0; i<MT_LEVEL; i++) {
-                Addr validAddr =
-                    mtBorders[i] + (verifiedCntOffs >> (i+1)*3);
-                if (state == Read) {
-                    validAddr = validAddr >> 6 << 6; // Alignment
+    PacketPtr write = findBufferedWrite(pkt);
+    if (write != nullptr && write->getAddr() == pkt->getAddr() &&
+        write->getSize() == pkt->getSize()) {
+        DPRINTF(SecCtrl, "Merging write of %#x\n", pkt->getAddr());
 
-                } else {
-                    assert(state == Write);
+        stats.mergedWrites++;
+        write->setData(pkt->getConstPtr<uint8_t>());
 
-                    validAddr = validAddr >> 3 << 3; // Alignment
-                }
+        if (pkt->needsResponse()) {
+            respondFromBuffer(pkt);
+        } else {
+            pendingDelete.reset(pkt);
+        }
 
-                if (pkt->getAddr() == validAddr) {
-                    metaPort.sendPacket(pkt);
+        return;
+    }
 
-                    return;
-                }
-            }
+    DPRINTF(SecCtrl, "Buffering write of %#x\n", pkt->getAddr());
+
+    if (pkt->needsResponse()) {
+        // Keep a copy of the data and acknowledge the original
+        write = new Packet(pkt, false, true);
+        write->setData(pkt->getConstPtr<uint8_t>());
+        respondFromBuffer(pkt);
+    } else {
+        write = pkt;
+    }
+
+    stats.bufferedWrites++;
+    writeBuffer.push_back(BufferedWrite{write, curTick()});
+    stats.writeBufferOccupancy = writeBuffer.size();
 
-            panic("Invalid blockedPkt in MemSidePort");
+    drainWriteBuffer();
+}
 
+bool
+SecCtrl::canDrainWrite(bool force) const
+{
+    if (writeBuffer.empty() || freeTransactions.empty() ||
+        crypto->full()) {
+        return false;
     }
+
+    return force || numActiveReads == 0 || readStalled ||
+        writeBuffer.size() >= writeHighThresh ||
+        drainState() == DrainState::Draining;
 }
 
 void
-SecCtrl::handleResponse(PacketPtr pkt)
+SecCtrl::drainWriteBuffer(bool force)
 {
-    // Communicate packets
-    switch (state) {
-        case Idle:
-            panic("Invalid state");
+    bool drained = false;
 
-        case Read:
-            if (pkt->getAddr() == verifiedPktAddr) {
-                responsePkt = pkt;
+    while (canDrainWrite(force)) {
+        BufferedWrite write = writeBuffer.front();
+        writeBuffer.pop_front();
+        stats.writeBufferOccupancy = writeBuffer.size();
 
-            } else if (pkt->getAddr() == cntBorder + verifiedCntOffs) {
-                counterPkt = pkt;
+        startTransaction(write.pkt, true, write.acceptTime);
+        drained = true;
+    }
 
-                updateChargeTime(curTick() + HASH_CYCLE * 1000);
+    // Only the crypto queue can hold back a buffer with nothing in flight
+    if (!writeBuffer.empty()) waitForCrypto();
 
-            } else if (pkt->getAddr() == macBorder + (verifiedCntOffs << 4)) {
-                macPkt = pkt;
+    if (drained) cpuSidePort.trySendRetryReq();
+}
 
-            } else {
-                for (uint8_t i=0; i<MT_LEVEL-2; i++) {
-                    Addr validAddr =
-                        mtBorders[i] + (verifiedCntOffs >> ((i+1)*3));
-                    validAddr = validAddr >> 6 << 6; // Alignment
+void
+SecCtrl::respondFromBuffer(PacketPtr pkt)
+{
+    pkt->makeResponse();
 
-                    if (pkt->getAddr() == validAddr) {
-                        mtPkts[i] = pkt;
+    bufferResponses.emplace_back(clockEdge(Cycles(1)), pkt);
+    if (!bufferRespEvent.scheduled()) {
+        scheduleEvent(bufferRespEvent, bufferResponses.front().first);
+    }
+}
 
-                        updateChargeTime(curTick() + HASH_CYCLE * 1000);
+void
+SecCtrl::processBufferResponses()
+{
+    while (!bufferResponses.empty() &&
+           bufferResponses.front().first <= curTick()) {
+        // A blocked response stays queued in cpuSidePort until the retry
+        cpuSidePort.sendPacket(bufferResponses.front().second);
+        bufferResponses.pop_front();
+    }
 
-                        if (pkt->req->getAccessDepth() == 0) {
-                            // No need more nodes
-                            break;
+    if (!bufferResponses.empty()) {
+        scheduleEvent(bufferRespEvent, bufferResponses.front().first);
+    }
 
-                        } else {
-                            sendMtPkt(i+1, true);
+    checkDrain();
+}
 
-                            break;
-                        }
-                    }
-                }
+void
+SecCtrl::waitForCrypto()
+{
+    // Nothing else wakes up the requestor when only the crypto queue
+    // is in the way
+    if (crypto->full() && !cryptoRetryEvent.scheduled()) {
+        scheduleEvent(cryptoRetryEvent, crypto->nextFreeTick());
+    }
+}
 
-                Addr validAddr =
-                    mtBorders[MT_LEVEL-2] +
-                    (verifiedCntOffs >> ((MT_LEVEL-1)*3));
-                validAddr = validAddr >> 6 << 6; // Alignment
+void
+SecCtrl::processCryptoRetry()
+{
+    drainWriteBuffer();
+    cpuSidePort.trySendRetryReq();
+    waitForCrypto();
+}
 
-                if (pkt->getAddr() == validAddr) {
-                    mtPkts[MT_LEVEL-2] = pkt;
+bool
+SecCtrl::isBusy() const
+{
+    return freeTransactions.size() != transactions.size() ||
+        cpuSidePort.blocked() || numBackgroundPkts != 0 ||
+        numOrphanFetches != 0 ||
+        !treeUpdates.empty() || !writeBuffer.empty() ||
+        !bufferResponses.empty();
+}
 
-                }
-            }
+void
+SecCtrl::checkDrain()
+{
+    if (drainState() == DrainState::Draining && !isBusy()) {
+        DPRINTF(Drain, "SecCtrl done draining\n");
+        signalDrainDone();
+    }
+}
 
-            if (responsePkt != nullptr &&
-                counterPkt != nullptr &&
-                macPkt != nullptr) {
+void
+SecCtrl::scheduleEvent(Event &event, Tick when)
+{
+    stats.scheduledEvents++;
+    schedule(event, when);
+}
 
-                updateChargeTime(curTick() + MAC_CYCLE * 1000);
-            }
+void
+SecCtrl::rescheduleEvent(Event &event, Tick when, bool always)
+{
+    stats.scheduledEvents++;
+    reschedule(event, when, always);
+}
 
-            break;
+void
+SecCtrl::freeTransaction(Transaction &txn)
+{
+    assert(txn.valid);
 
-        case Write:
-            if (pkt->getAddr() == verifiedPktAddr) {
-                assert(needsResponse);
+    // The walk ends at the first cached node, whatever was fetched
+    // above it
+    uint8_t depth = 0;
+    while (depth < mtLevel-1 && txn.mtPkts[depth] != nullptr) {
+        if (txn.mtPkts[depth++]->req->getAccessDepth() == 0) break;
+    }
+    stats.mtWalkDepth.sample(depth);
 
-                responsePkt = pkt;
+    if (txn.isRead) {
+        stats.wastedTreeFetches += txn.mtIssued - depth;
 
-                updateChargeTime(curTick());
+        // Left to be dropped when they come back
+        for (uint8_t i=depth; i<txn.mtIssued; i++) {
+            if (txn.mtPkts[i] == nullptr) numOrphanFetches++;
+        }
+    }
 
-            } else if (pkt->getAddr() == cntBorder + verifiedCntOffs) {
-                counterPkt = pkt;
+    // The walk is over, so recycle its metadata packets
+    if (txn.counterPkt != nullptr) releasePkt(txn.counterPkt);
+    if (txn.macPkt != nullptr) releasePkt(txn.macPkt);
+    for (auto mt_pkt : txn.mtPkts) {
+        if (mt_pkt != nullptr) releasePkt(mt_pkt);
+    }
 
-                schedule(sendMacWrite, curTick() + MAC_CYCLE * 1000);
-                schedule(sendNextMtWrite, curTick() + HASH_CYCLE * 1000);
+    if (txn.isRead) {
+        assert(numActiveReads > 0);
+        numActiveReads--;
+    }
 
-            } else if (pkt->getAddr() == macBorder + (verifiedCntOffs << 4)) {
-                macPkt = pkt;
+    txn.reset();
+    freeTransactions.push_back(txn.id);
 
-                updateChargeTime(curTick());
+    drainWriteBuffer();
+    cpuSidePort.trySendRetryReq();
+    checkDrain();
+}
 
-            } else {
-                if (pkt->isRead()) {
-                    for (uint8_t i=0; i<MT_LEVEL-2; i++) {
-                        Addr validAddr =
-                            mtBorders[i] + (verifiedCntOffs >> ((i+1)*3));
-                        validAddr = validAddr >> 6 << 6; // Alignment
+PacketPtr
+SecCtrl::allocPkt(Addr addr, unsigned size, Request::Flags flags,
+                  RequestorID requestorId, MemCmd cmd)
+{
+    assert(size <= NODE_SPACE);
 
-                        if (pkt->getAddr() == validAddr) {
-                            // Write should be done
-                            assert(mtPkts[i] != nullptr);
+    RequestPtr req;
+    if (!freeRequests.empty()) {
+        req = std::move(freeRequests.back());
+        freeRequests.pop_back();
 
-                            schedule(sendNextMtWrite,
-                                     curTick() + HASH_CYCLE * 1000);
+        // Rebuild the request, which also clears its access depth
+        req->~Request();
+        new (req.get()) Request(addr, size, flags, requestorId);
+    } else {
+        req = std::make_shared<Request>(addr, size, flags, requestorId);
+    }
 
-                            return;
-                        }
+    PacketPtr pkt;
+    if (!freePkts.empty()) {
+        pkt = new (freePkts.back()) Packet(req, cmd);
+        freePkts.pop_back();
+    } else {
+        pkt = new Packet(req, cmd);
+    }
 
-                    }
+    uint8_t *data;
+    if (!freeBuffers.empty()) {
+        data = freeBuffers.back();
+        freeBuffers.pop_back();
+    } else {
+        data = new uint8_t[NODE_SPACE];
+    }
+    pkt->dataStatic(data); // just empty here
 
-                    Addr validAddr =
-                        mtBorders[MT_LEVEL-2] +
-                        (verifiedCntOffs >> ((MT_LEVEL-1)*3));
-                    validAddr = validAddr >> 6 << 6; // Alignment
+    return pkt;
+}
 
-                    updateChargeTime(curTick() + HASH_CYCLE * 1000);
+void
+SecCtrl::releasePkt(PacketPtr pkt)
+{
+    assert(pkt->senderState == nullptr);
 
-                    panic_if(pkt->getAddr() != validAddr, "Invalid addr");
+    // The payload is static, so the packet leaves it alone
+    freeBuffers.push_back(pkt->getPtr<uint8_t>());
 
-                } else {
-                    for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-                        Addr validAddr =
-                            mtBorders[i] + (verifiedCntOffs >> ((i+1)*3));
-                        validAddr = validAddr >> 3 << 3; // Alignment
+    // Only recycle a request nobody else still refers to
+    if (pkt->req.use_count() == 1) {
+        freeRequests.push_back(pkt->req);
+    }
 
-                        if (pkt->getAddr() == validAddr) {
-                            mtPkts[i] = pkt;
+    pkt->~Packet();
+    freePkts.push_back(pkt);
+}
 
-                            if (pkt->req->getAccessDepth() == 0) {
-                                // No need more nodes
-                                updateChargeTime(curTick() + HASH_CYCLE * 1000);
+PacketPtr
+SecCtrl::createMetaPkt(Transaction &txn, Addr addr, unsigned size,
+                       bool isRead, PktType type, uint8_t level)
+{
+    // Select packet command
+    MemCmd cmd = isRead ? MemCmd::ReadReq : MemCmd::WriteReq;
 
-                                break;
+    PacketPtr retPkt =
+        allocPkt(toMem(addr), size, txn.flags, txn.requestorId, cmd);
 
-                            } else {
-                                sendMtPkt(i, true);
+    retPkt->pushSenderState(
+            new SecSenderState(txn.id, type, level, txn.verifiedPktAddr,
+                               txn.seq));
 
-                                return;
-                            }
-                        }
-                    }
-                }
-            }
+    if (type >= CntUpdatePkt) numBackgroundPkts++;
 
-            break;
+    return retPkt;
+}
 
+bool
+SecCtrl::sendMetaPkt(PacketPtr pkt)
+{
+    if (pkt->isRead()) {
+        stats.metaBytesRead += pkt->getSize();
+    } else {
+        stats.metaBytesWritten += pkt->getSize();
     }
 
-    // Check Verification
-    switch (state) {
-        case Idle:
-            panic("Invalid state");
-
-        case Read:
-            assert(needsResponse);
+    return metaPort.sendPacket(pkt);
+}
 
-            if (responsePkt == nullptr ||
-                counterPkt == nullptr ||
-                macPkt == nullptr) {
+Tick
+SecCtrl::onChipLatency(uint8_t level) const
+{
+    return level < mtLevel-1 ? cyclesToTicks(pinnedLatency) : 0;
+}
 
-                // Verification is not finished
-                return;
-            }
+bool
+SecCtrl::sendCntPkt(Transaction &txn, bool isRead)
+{
+    // The updated counter is written back without being waited for
+    PacketPtr cntPkt = createMetaPkt(
+            txn,
+            cntAddr(txn.verifiedCntOffs),
+            cntSize(),
+            isRead,
+            isRead ? CounterPkt : CntUpdatePkt,
+            0);
+
+    return sendMetaPkt(cntPkt);
+}
 
-            for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-                if (mtPkts[i] == nullptr) {
-                    // Verification is not finished
-                    return;
+bool
+SecCtrl::sendTreeUpdatePkt(const TreeUpdate &update)
+{
+    PacketPtr pkt = allocPkt(toMem(update.addr), mtSize(false), 0,
+                             update.requestorId, MemCmd::WriteReq);
+    pkt->pushSenderState(new SecSenderState(0, MtUpdatePkt, update.level));
+    numBackgroundPkts++;
 
-                } else {
-                    if (mtPkts[i]->req->getAccessDepth() == 0) {
-                        // Verification is finished
-                        break;
-                    }
-                }
+    return sendMetaPkt(pkt);
+}
+
+bool
+SecCtrl::sendReencPkt(Addr addr, unsigned size, bool isRead, PktType type,
+                      RequestorID requestorId, const uint8_t *data)
+{
+    PacketPtr pkt = allocPkt(toMem(addr), size, 0, requestorId,
+            isRead ? MemCmd::ReadReq : MemCmd::WriteReq);
+    if (data != nullptr) pkt->setData(data);
+    pkt->pushSenderState(new SecSenderState(0, type, 0));
+    numBackgroundPkts++;
+
+    // Data goes to memory, MACs go through the metadata cache
+    if (addr < cntBorder) {
+        return memPort.sendPacket(pkt);
+    } else {
+        return sendMetaPkt(pkt);
+    }
+}
+
+bool
+SecCtrl::sendPrefetchPkt(Addr blk, RequestorID requestorId)
+{
+    // A plain read, so that the response tells whether the block missed
+    PacketPtr pkt = allocPkt(toMem(blk * NODE_SPACE), NODE_SPACE, 0,
+                             requestorId, MemCmd::ReadReq);
+    pkt->pushSenderState(new SecSenderState(0, PrefetchPkt, 0));
+    numBackgroundPkts++;
+
+    return sendMetaPkt(pkt);
+}
+
+void
+SecCtrl::prefetchMetadata(Addr pktAddr, RequestorID requestorId)
+{
+    prefetchAddrs.clear();
+    prefetcher->notify(pktAddr, requestorId, prefetchAddrs);
+
+    // The metadata of the access itself is on its way already
+    Addr cnt_blk = cntAddr(counterOffset(pktAddr)) / NODE_SPACE;
+    Addr mac_blk = macAddr(pktAddr) / NODE_SPACE;
+
+    for (Addr addr : prefetchAddrs) {
+        // Predictions may run off the protected data
+        if (addr >= cntBorder) continue;
+
+        Addr blk = cntAddr(counterOffset(addr)) / NODE_SPACE;
+        if (blk != cnt_blk && prefetcher->track(blk)) {
+            sendPrefetchPkt(blk, requestorId);
+        }
+
+        blk = macAddr(addr) / NODE_SPACE;
+        if (!macInline && blk != mac_blk && prefetcher->track(blk)) {
+            sendPrefetchPkt(blk, requestorId);
+        }
+    }
+}
+
+bool
+SecCtrl::incrementCounter(Addr pktAddr)
+{
+    return countCounterUpdate(counters.increment(pktAddr), pktAddr);
+}
+
+bool
+SecCtrl::countCounterUpdate(SecCounters::Update update, Addr pktAddr)
+{
+    switch (update) {
+        case SecCounters::Reencoded:
+            stats.counterReencodings++;
+
+            DPRINTF(SecCtrl, "Counter block of %#x re-encoded\n", pktAddr);
+
+            return false;
+
+        case SecCounters::Overflowed:
+            stats.counterOverflows++;
+
+            DPRINTF(SecCtrl, "Minor counter of %#x overflowed, major "
+                    "counter is %d now\n", pktAddr,
+                    counters.blocks().at(
+                        pktAddr / NODE_SPACE / cntsPerBlock).major);
+
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void
+SecCtrl::reencryptCounterBlock(Addr cntBlk, RequestorID requestorId)
+{
+    Addr first_blk = cntBlk * cntsPerBlock;
+    Addr last_blk = std::min(first_blk + cntsPerBlock,
+                             (Addr)(dataSpace / NODE_SPACE));
+
+    // Each block is written back once its read returns
+    stats.reencryptedBlocks += last_blk - first_blk;
+
+    for (Addr blk = first_blk; blk < last_blk; blk++) {
+        ReencBlock &reenc = reencBlocks[blk];
+        reenc.pendingReads++;
+
+        sendReencPkt(blk * NODE_SPACE, NODE_SPACE, true, ReencReadPkt,
+                     requestorId);
+    }
+}
+
+void
+SecCtrl::noteDataWrite(Addr addr, unsigned size)
+{
+    if (reencBlocks.empty()) return;
+
+    for (Addr blk = addr / NODE_SPACE; blk * NODE_SPACE < addr + size;
+         blk++) {
+        auto it = reencBlocks.find(blk);
+        if (it != reencBlocks.end()) it->second.overwritten = true;
+    }
+}
+
+bool
+SecCtrl::sendMacPkt(Transaction &txn, bool isRead)
+{
+    PacketPtr macPkt = createMetaPkt(
+            txn,
+            macAddr(txn.verifiedPktAddr),
+            macSize,
+            isRead,
+            MacPkt,
+            0);
+
+    return sendMetaPkt(macPkt);
+}
+
+bool
+SecCtrl::sendMtPkt(Transaction &txn, uint8_t nth, bool isRead)
+{
+    PacketPtr mtPkt = createMetaPkt(
+            txn,
+            mtAddr(txn.verifiedCntOffs, nth, isRead),
+            mtSize(isRead),
+            isRead,
+            MtPkt,
+            nth);
+
+    return sendMetaPkt(mtPkt);
+}
+
+bool
+SecCtrl::mtWalkFinished(const Transaction &txn) const
+{
+    // Writes leave the tree to the evictions of the metadata cache
+    if (lazyTreeUpdates && !txn.isRead) return true;
+
+    // The node of the level is written, its hash is not updated yet
+    if (txn.mtReadPending) return false;
+
+    for (uint8_t i=0; i<pinnedLevel; i++) {
+        if (txn.mtPkts[i] == nullptr) {
+            // Verification is not finished
+            return false;
+
+        } else if (txn.mtPkts[i]->req->getAccessDepth() == 0) {
+            // The node was cached, so it is already verified
+            return true;
+        }
+    }
+
+    // Reached the on-chip levels
+    return true;
+}
+
+void
+SecCtrl::fetchTreeLevels(Transaction &txn, uint8_t first)
+{
+    unsigned end = pinnedLevel;
+    if (treeFetchWindow != 0) {
+        end = std::min<unsigned>(end, first + treeFetchWindow);
+    }
+
+    for (; txn.mtIssued < end; txn.mtIssued++) {
+        if (txn.mtIssued > first) stats.aheadTreeFetches++;
+
+        sendMtPkt(txn, txn.mtIssued, true);
+    }
+}
+
+bool
+SecCtrl::verifyTreeLevels(Transaction &txn)
+{
+    bool verified = false;
+
+    while (txn.mtVerified < pinnedLevel &&
+           txn.mtPkts[txn.mtVerified] != nullptr) {
+        uint8_t level = txn.mtVerified++;
+        verified = true;
+
+        updateChargeTime(txn, reserveHash(txn, MtPkt, level, curTick()));
+
+        if (txn.mtPkts[level]->req->getAccessDepth() == 0) {
+            // The node was cached, so it is already verified and nothing
+            // above it is needed
+            txn.mtVerified = pinnedLevel;
+        } else if (level+1 < pinnedLevel) {
+            // Verify the parent node as well
+            fetchTreeLevels(txn, level+1);
+        } else {
+            // The parent is on chip
+            stats.pinnedAccesses++;
+            updateChargeTime(txn, curTick() + onChipLatency(level+1));
+        }
+    }
+
+    return verified;
+}
+
+bool
+SecCtrl::handleRequest(PacketPtr pkt)
+{
+    HostTimer timer(hostProfile ? &stats.hostRequestTime : nullptr);
+
+    if (pkt->isRead()) {
+        stats.readReqs++;
+        readStalled = false;
+    } else {
+        stats.writeReqs++;
+        noteDataWrite(toLocal(pkt->getAddr()), pkt->getSize());
+    }
+
+    if (writeBufferSize > 0 && pkt->isWrite()) {
+        bufferWrite(pkt);
+        return true;
+    }
+
+    PacketPtr write =
+        writeBufferSize > 0 ? findBufferedWrite(pkt) : nullptr;
+    if (write != nullptr) {
+        // The data never left the chip, so there is nothing to verify
+        DPRINTF(SecCtrl, "Read of %#x served by the write buffer\n",
+                pkt->getAddr());
+
+        stats.forwardedReads++;
+        pkt->setData(write->getConstPtr<uint8_t>() +
+                     (pkt->getAddr() - write->getAddr()));
+        respondFromBuffer(pkt);
+
+        return true;
+    }
+
+    startTransaction(pkt, false, curTick());
+
+    return true;
+}
+
+void
+SecCtrl::startTransaction(PacketPtr pkt, bool posted, Tick acceptTime)
+{
+    assert(!freeTransactions.empty());
+
+    Transaction &txn = *transactions[freeTransactions.back()];
+    freeTransactions.pop_back();
+
+    // Store the information of the packet
+    txn.valid = true;
+    txn.isRead = pkt->isRead();
+    txn.seq = nextTxnSeq++;
+    txn.posted = posted;
+    txn.chargeTime = curTick();
+    txn.startTime = acceptTime;
+    txn.issueTime = curTick();
+    txn.padTime = 0;
+    txn.macTime = 0;
+
+    if (txn.isRead) numActiveReads++;
+
+    // Verified Counter Offset (BMT)
+    txn.verifiedPktAddr = toLocal(pkt->getAddr());
+    txn.verifiedCntOffs = counterOffset(txn.verifiedPktAddr);
+    // Params of the packet
+    txn.flags = pkt->req->getFlags();
+    txn.requestorId = pkt->req->requestorId();
+    // Whether the pkt needs response or not
+    txn.needsResponse = pkt->needsResponse();
+
+    DPRINTF(SecCtrl, "Transaction %d starts for %#x\n",
+            txn.id, txn.verifiedPktAddr);
+
+    // Only tag packets whose response will come back
+    if (txn.needsResponse) {
+        pkt->pushSenderState(new SecSenderState(txn.id, DataPkt, 0));
+    }
+
+    if (txn.isRead) {
+        // Coverable all failures
+        // because they are queued in each port
+        memPort.sendPacket(pkt);
+        sendCntPkt(txn, true);
+        if (!macInline) sendMacPkt(txn, true);
+        if (pinnedLevel > 0) {
+            fetchTreeLevels(txn, 0);
+        } else {
+            // The parent of the counter is on chip
+            stats.pinnedAccesses++;
+            updateChargeTime(txn, curTick() + onChipLatency(0));
+        }
+
+    } else {
+        // Coverable of both failures
+        // because they are queued in each port
+        memPort.sendPacket(pkt);
+        sendCntPkt(txn, true);
+    }
+
+    // Behind the demand accesses
+    if (prefetcher != nullptr) {
+        prefetchMetadata(txn.verifiedPktAddr, txn.requestorId);
+    }
+}
+
+void
+SecCtrl::handleResponse(PacketPtr pkt)
+{
+    // Includes the requests let in by the retries it sends
+    HostTimer timer(hostProfile ? &stats.hostResponseTime : nullptr);
+    if (hostProfile) stats.hostResponses++;
+
+    // Find the transaction the packet belongs to
+    SecSenderState *senderState =
+        dynamic_cast<SecSenderState *>(pkt->popSenderState());
+    panic_if(senderState == nullptr,
+             "Response %s without a transaction", pkt->print());
+
+    Transaction &txn = *transactions[senderState->txnId];
+    PktType type = senderState->type;
+    uint8_t level = senderState->level;
+    Addr data_addr = senderState->dataAddr;
+    uint64_t txn_seq = senderState->txnSeq;
+    delete senderState;
+
+    recordMetaAccess(pkt, type, level);
+    if (traceStream != nullptr) {
+        traceMetaAccess(pkt, type, level, data_addr,
+                        curTick() - pkt->req->time());
+    }
+
+    if (type >= CntUpdatePkt) {
+        handleBackgroundResponse(pkt, type);
+        return;
+    }
+
+    if (type == MtPkt && (!txn.valid || txn.seq != txn_seq)) {
+        // Fetched ahead by a walk which ended below it
+        assert(numOrphanFetches > 0);
+        numOrphanFetches--;
+        releasePkt(pkt);
+        checkDrain();
+        return;
+    }
+
+    if (timelineStream != nullptr) timelineAccess(txn, pkt, type, level);
+
+    panic_if(!txn.valid, "Response %s for an idle transaction",
+             pkt->print());
+
+    if (txn.isRead) {
+        handleReadResponse(txn, pkt, type, level);
+    } else {
+        handleWriteResponse(txn, pkt, type, level);
+    }
+}
+
+void
+SecCtrl::recordMetaAccess(PacketPtr pkt, PktType type, uint8_t level)
+{
+    bool hit = pkt->req->getAccessDepth() == 0;
+
+    switch (type) {
+        case CounterPkt:
+        case CntUpdatePkt:
+            if (hit) stats.counterHits++; else stats.counterMisses++;
+            break;
+
+        case MacPkt:
+            if (hit) stats.macHits++; else stats.macMisses++;
+            break;
+
+        case MtPkt:
+            if (hit) stats.mtHits[level]++; else stats.mtMisses[level]++;
+            break;
+
+        default:
+            // Data and re-encryption traffic
+            break;
+    }
+
+    // Only metadata goes through the metadata cache
+    Addr addr = toLocal(pkt->getAddr());
+    if (shadowCapacity != 0 && addr >= cntBorder) {
+        recordShadowAccess(addr, hit);
+    }
+
+    if (prefetcher != nullptr) {
+        if (type == PrefetchPkt) {
+            prefetcher->prefetchDone(addr / NODE_SPACE, hit, NODE_SPACE);
+        } else if (type == CounterPkt || type == CntUpdatePkt ||
+                   type == MacPkt) {
+            prefetcher->demandAccess(addr / NODE_SPACE, hit);
+        }
+    }
+}
+
+void
+SecCtrl::traceMetaAccess(PacketPtr pkt, PktType type, uint8_t level,
+                         Addr dataAddr, Tick latency)
+{
+    // Data and re-encrypted blocks are not metadata
+    Addr addr = toLocal(pkt->getAddr());
+    if (addr < cntBorder) return;
+
+    traceBuffer.push_back({ pkt->req->time(), addr, dataAddr,
+            uint32_t(std::min<Tick>(latency, UINT32_MAX)), uint8_t(type),
+            level, pkt->isWrite(),
+            uint8_t(std::min(pkt->req->getAccessDepth(), UINT8_MAX)) });
+
+    if (traceBuffer.size() == traceBufferRecords) flushTrace();
+}
+
+void
+SecCtrl::flushTrace()
+{
+    if (traceStream == nullptr) return;
+
+    traceStream->stream()->write(
+            reinterpret_cast<const char *>(traceBuffer.data()),
+            traceBuffer.size() * sizeof(MetaTraceRecord));
+    traceBuffer.clear();
+    traceStream->stream()->flush();
+}
+
+void
+SecCtrl::timelineEvent(const Transaction &txn, unsigned track,
+                       const char *name, Tick start, Tick end, bool instant)
+{
+    // Chrome traces count in microseconds
+    const double us = sim_clock::as_float::us;
+
+    char duration[48] = "\"s\":\"t\"";
+    if (!instant) {
+        snprintf(duration, sizeof(duration), "\"dur\":%.6f",
+                 (end - start) / us);
+    }
+
+    char event[256];
+    snprintf(event, sizeof(event),
+             ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+             "\"pid\":0,\"tid\":%u,\"ts\":%.6f,%s,"
+             "\"args\":{\"addr\":\"%#llx\"}}",
+             name, txn.isRead ? "read" : "write", instant ? "i" : "X",
+             txn.id * timelineTracks + track, start / us, duration,
+             (unsigned long long)txn.verifiedPktAddr);
+    timelineBuffer += event;
+
+    if (timelineBuffer.size() >= timelineBufferBytes) flushTimeline(false);
+}
+
+void
+SecCtrl::timelineAccess(const Transaction &txn, PacketPtr pkt, PktType type,
+                        uint8_t level)
+{
+    // The data left with the request, metadata packets are made on the
+    // spot
+    Tick sent = type == DataPkt ? txn.issueTime : pkt->req->time();
+
+    std::string name;
+    unsigned track;
+    switch (type) {
+        case DataPkt:
+            name = "data";
+            track = DataTrack;
+            break;
+        case CounterPkt:
+            name = "counter";
+            track = CounterTrack;
+            break;
+        case MacPkt:
+            name = "mac";
+            track = MacTrack;
+            break;
+        case MtPkt:
+            name = "tree L" + std::to_string(level);
+            track = TreeTracks + 2 * level;
+            break;
+        default:
+            panic("Unexpected packet type %d", type);
+    }
+    if (pkt->isWrite()) name += " write";
+
+    timelineEvent(txn, track, name.c_str(), sent, curTick());
+}
+
+void
+SecCtrl::flushTimeline(bool last)
+{
+    if (timelineStream == nullptr) return;
+
+    if (last) timelineBuffer += "\n]\n";
+
+    timelineStream->stream()->write(timelineBuffer.data(),
+                                    timelineBuffer.size());
+    timelineBuffer.clear();
+    if (last) timelineStream->stream()->flush();
+}
+
+Tick
+SecCtrl::reserveHash(const Transaction &txn, PktType type, uint8_t level,
+                     Tick ready)
+{
+    Tick done = crypto->reserve(CryptoEngine::Hash, ready);
+
+    if (timelineStream != nullptr) {
+        // The slot the hash got, after any wait for a unit
+        Tick start = done - crypto->latency(CryptoEngine::Hash);
+        if (type == CounterPkt) {
+            timelineEvent(txn, CounterHashTrack, "counter hash", start,
+                          done);
+        } else {
+            std::string name = "hash L" + std::to_string(level);
+            timelineEvent(txn, TreeTracks + 2 * level + 1, name.c_str(),
+                          start, done);
+        }
+    }
+
+    return done;
+}
+
+void
+SecCtrl::recordShadowAccess(Addr addr, bool hit)
+{
+    Addr blk = addr / NODE_SPACE;
+
+    auto it = shadowIndex.find(blk);
+    if (it != shadowIndex.end()) {
+        if (!hit) stats.conflictMisses++;
+
+        shadowBlocks.splice(shadowBlocks.begin(), shadowBlocks, it->second);
+    } else {
+        if (shadowBlocks.size() == shadowCapacity) {
+            shadowIndex.erase(shadowBlocks.back());
+            shadowBlocks.pop_back();
+        }
+
+        shadowBlocks.push_front(blk);
+        shadowIndex.emplace(blk, shadowBlocks.begin());
+    }
+
+    if (!hit) stats.metaMisses++;
+}
+
+void
+SecCtrl::handleBackgroundResponse(PacketPtr pkt, PktType type)
+{
+    if (type == ReencReadPkt) {
+        Addr addr = toLocal(pkt->getAddr());
+        Addr blk = addr / NODE_SPACE;
+
+        auto it = reencBlocks.find(blk);
+        assert(it != reencBlocks.end());
+        bool overwritten = it->second.overwritten;
+        if (--it->second.pendingReads == 0) reencBlocks.erase(it);
+
+        if (overwritten) {
+            // The CPU wrote the block since, with its own MAC under the
+            // new counter
+            DPRINTF(SecCtrl, "Re-encryption of %#x dropped for a newer "
+                    "write\n", addr);
+        } else {
+            // Write the re-encrypted block and its new MAC. The contents
+            // are kept in the clear, so the block is written as read.
+            sendReencPkt(addr, NODE_SPACE, false, ReencWritePkt,
+                         pkt->req->requestorId(),
+                         pkt->getConstPtr<uint8_t>());
+            if (!macInline) {
+                sendReencPkt(macAddr(blk * NODE_SPACE), macSize, false,
+                             ReencWritePkt, pkt->req->requestorId());
+            } else {
+                stats.metaBytesWritten += macSize;
             }
+        }
+    }
 
-            // Sanity Check
-            for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-                Addr validAddr =
-                    mtBorders[i] + (verifiedCntOffs >> ((i+1)*3));
-                validAddr = validAddr >> 6 << 6; // Alignment
+    // Nothing waits for the packet
+    releasePkt(pkt);
 
-                if (mtPkts[i]->getAddr() != validAddr) {
-                    panic("mtNode's addr is not valid");
-                }
+    assert(numBackgroundPkts > 0);
+    numBackgroundPkts--;
+    checkDrain();
+}
 
-                if (mtPkts[i]->req->getAccessDepth() == 0) {
-                    break;
-                }
+void
+SecCtrl::handleEviction(Addr addr, RequestorID requestorId, bool atomic)
+{
+    Addr parent;
+    uint8_t level;
+    if (!lazyTreeUpdates || !parentNode(toLocal(addr), parent, level)) {
+        return;
+    }
+
+    DPRINTF(SecCtrl, "Eviction of %#x updates tree level %d\n",
+            addr, level);
+
+    stats.evictionUpdates++;
+
+    if (atomic) {
+        // Sent once the atomic access causing the eviction is done
+        if (level < pinnedLevel) {
+            treeUpdates.emplace(curTick(),
+                                TreeUpdate{parent, level, requestorId});
+        }
+
+        return;
+    }
+
+    Tick done = crypto->reserve(CryptoEngine::Hash, curTick());
+
+    // An on-chip parent only needs the hash
+    if (level >= pinnedLevel) return;
+
+    treeUpdates.emplace(done, TreeUpdate{parent, level, requestorId});
+    if (!treeUpdateEvent.scheduled() || treeUpdateEvent.when() > done) {
+        rescheduleEvent(treeUpdateEvent, done, true);
+    }
+}
+
+void
+SecCtrl::processTreeUpdates()
+{
+    while (!treeUpdates.empty() &&
+           treeUpdates.begin()->first <= curTick()) {
+        // The write dirties the parent in the metadata cache, whose
+        // eviction carries the update further up
+        sendTreeUpdatePkt(treeUpdates.begin()->second);
+        treeUpdates.erase(treeUpdates.begin());
+    }
+
+    if (!treeUpdates.empty()) {
+        scheduleEvent(treeUpdateEvent, treeUpdates.begin()->first);
+    }
+}
+
+void
+SecCtrl::handleReadResponse(Transaction &txn, PacketPtr pkt,
+                            PktType type, uint8_t level)
+{
+    assert(txn.needsResponse);
+
+    // Communicate packets
+    switch (type) {
+        case DataPkt:
+            txn.responsePkt = pkt;
+
+            if (macInline) {
+                // The MAC follows the data in the extra bursts
+                stats.metaBytesRead += macSize;
+                txn.macDone = true;
+                txn.macTime = curTick() + cyclesToTicks(macBurstLatency);
             }
 
-            // Verification is finished
-            schedule(readVerFinished, chargeTime);
+            break;
 
-            return;
+        case CounterPkt:
+            txn.counterPkt = pkt;
+
+            // Generate the pad while the data is still on its way, and
+            // verify the counter against its parent
+            txn.padTime = crypto->reserve(CryptoEngine::Aes, curTick());
+            updateChargeTime(txn,
+                    reserveHash(txn, type, 0, curTick()));
+
+            break;
+
+        case MacPkt:
+            txn.macPkt = pkt;
+            txn.macDone = true;
+
+            break;
+
+        case MtPkt:
+            txn.mtPkts[level] = pkt;
 
-        case Write:
-            if (needsResponse && responsePkt == nullptr) {
-                // Verification is not finished
+            if (!verifyTreeLevels(txn)) {
+                // A level below is still on its way, or the walk ended
+                // below this one
                 return;
             }
 
-            if (counterPkt == nullptr || macPkt == nullptr) {
-                // Verification is not finished
-                return;
+            break;
+
+        default:
+            panic("Unexpected packet type %d", type);
+    }
+
+    if (txn.responsePkt == nullptr || txn.counterPkt == nullptr) {
+        // Decryption is not possible yet
+        return;
+    }
+
+    if (type == DataPkt || type == CounterPkt) {
+        // The MAC of the ciphertext is computed as soon as its inputs are
+        // here, it does not wait for the stored MAC
+        txn.macTime = std::max(txn.macTime,
+                crypto->reserve(CryptoEngine::Mac, curTick()));
+
+        if (type == DataPkt && txn.padTime > curTick()) {
+            stats.padStalls++;
+        }
+
+        if (speculationWindow != 0 && numUnverified < speculationWindow) {
+            // Decrypt and send the data, verification goes on behind
+            txn.forwarded = true;
+            numUnverified++;
+            stats.speculativeReads++;
+
+            scheduleEvent(txn.forwardData,
+                          std::max(txn.padTime, curTick()) +
+                          crypto->compareLatency());
+        } else if (speculationWindow != 0) {
+            // Too much unverified data is out already, so the read waits
+            // for its verification
+            stats.speculationStalls++;
+        }
+    }
+
+    if (!txn.macDone) {
+        // Verification is not finished
+        return;
+    }
+
+    if (type != MtPkt) {
+        // Data, counter and MAC are all here now, so only the XOR with
+        // the pad and the MAC compare are left
+        updateChargeTime(txn,
+                std::max({txn.padTime, txn.macTime, curTick()}) +
+                crypto->compareLatency());
+    }
+
+    if (!mtWalkFinished(txn)) {
+        // Verification is not finished
+        return;
+    }
+
+    // Verification is finished
+    scheduleEvent(txn.readVerFinished, std::max(txn.chargeTime, curTick()));
+}
+
+void
+SecCtrl::handleWriteResponse(Transaction &txn, PacketPtr pkt,
+                             PktType type, uint8_t level)
+{
+    // Communicate packets
+    switch (type) {
+        case DataPkt:
+            assert(txn.needsResponse);
+
+            txn.responsePkt = pkt;
+
+            updateChargeTime(txn, curTick());
+
+            break;
+
+        case CounterPkt:
+            txn.counterPkt = pkt;
+
+            // Write back the incremented counter
+            if (incrementCounter(txn.verifiedPktAddr)) {
+                reencryptCounterBlock(
+                        txn.verifiedPktAddr / NODE_SPACE / cntsPerBlock,
+                        txn.requestorId);
+            }
+            sendCntPkt(txn, false);
+
+            // The MAC covers the data encrypted with the new pad
+            txn.macTime = crypto->reserve(CryptoEngine::Mac,
+                    crypto->reserve(CryptoEngine::Aes, curTick()));
+            if (macInline) {
+                // Written with the data in its extra bursts
+                stats.metaBytesWritten += macSize;
+                txn.macDone = true;
+                updateChargeTime(txn,
+                        txn.macTime + cyclesToTicks(macBurstLatency));
+            } else {
+                scheduleEvent(txn.sendMacWrite, txn.macTime);
             }
+            if (!lazyTreeUpdates && pinnedLevel > 0) {
+                scheduleEvent(txn.sendNextMtWrite,
+                              reserveHash(txn, type, 0, curTick()));
+            } else if (!lazyTreeUpdates) {
+                // The parent of the counter is on chip
+                stats.pinnedAccesses++;
+                updateChargeTime(txn,
+                        reserveHash(txn, type, 0, curTick()) +
+                        onChipLatency(0));
+            }
+
+            break;
+
+        case MacPkt:
+            txn.macPkt = pkt;
+            txn.macDone = true;
+
+            updateChargeTime(txn, curTick());
+
+            break;
+
+        case MtPkt:
+            if (pkt->isRead()) {
+                // Write should be done
+                assert(txn.mtPkts[level] != nullptr);
+                assert(txn.mtReadPending);
+                txn.mtReadPending = false;
+
+                // Only the write of the level is kept
+                releasePkt(pkt);
+
+                if (level+1 < pinnedLevel) {
+                    scheduleEvent(txn.sendNextMtWrite,
+                                  reserveHash(txn, type, level, curTick()));
 
-            for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-                if (mtPkts[i] == nullptr) {
-                    // Verification is not finished
                     return;
-                } else {
-                    if (mtPkts[i]->req->getAccessDepth() == 0) {
-                        // Verification is finished
-                        break;
-                    }
                 }
-            }
 
-            // Sanity Check
-            for (uint8_t i=0; i<MT_LEVEL-1; i++) {
-                Addr validAddr =
-                    mtBorders[i] + (verifiedCntOffs >> ((i+1)*3));
-                validAddr = validAddr >> 3 << 3; // Alignment
+                // Update the on-chip parent
+                stats.pinnedAccesses++;
+                updateChargeTime(txn,
+                        reserveHash(txn, type, level, curTick()) +
+                        onChipLatency(level+1));
 
-                if (mtPkts[i]->getAddr() != validAddr) {
-                    panic("mtNode's addr is not valid");
-                }
+            } else {
+                txn.mtPkts[level] = pkt;
+
+                if (pkt->req->getAccessDepth() == 0) {
+                    // No need more nodes
+                    updateChargeTime(txn,
+                            reserveHash(txn, type, level, curTick()));
 
-                if (mtPkts[i]->req->getAccessDepth() == 0) {
-                    break;
+                } else {
+                    txn.mtReadPending = true;
+                    sendMtPkt(txn, level, true);
+
+                    return;
                 }
             }
 
-            // Verification is finished
-            schedule(writeVerFinished, chargeTime);
+            break;
 
-            return;
+        default:
+            panic("Unexpected packet type %d", type);
+    }
+
+    // Check Verification
+    if (txn.needsResponse && txn.responsePkt == nullptr) {
+        // Verification is not finished
+        return;
+    }
 
+    if (txn.counterPkt == nullptr || !txn.macDone) {
+        // Verification is not finished
+        return;
     }
 
+    if (!mtWalkFinished(txn)) {
+        // Verification is not finished
+        return;
+    }
+
+    // Verification is finished
+    scheduleEvent(txn.writeVerFinished, std::max(txn.chargeTime, curTick()));
+}
+
+Tick
+SecCtrl::sendAtomicMeta(const RequestPtr &origReq, Addr addr, unsigned size,
+                        bool isRead, PktType type, uint8_t level, bool &hit)
+{
+    PacketPtr pkt = allocPkt(toMem(addr), size, origReq->getFlags(),
+                             origReq->requestorId(),
+                             isRead ? MemCmd::ReadReq : MemCmd::WriteReq);
+
+    if (isRead) {
+        stats.metaBytesRead += size;
+    } else {
+        stats.metaBytesWritten += size;
+    }
+
+    Tick latency = metaPort.sendAtomic(pkt);
+
+    recordMetaAccess(pkt, type, level);
+    if (traceStream != nullptr) {
+        traceMetaAccess(pkt, type, level,
+                        toLocal(origReq->getPaddr()), latency);
+    }
+    hit = pkt->req->getAccessDepth() == 0;
+
+    releasePkt(pkt);
+
+    return latency;
+}
+
+Tick
+SecCtrl::sendAtomicWalk(const RequestPtr &origReq,
+                        const SecWalk::Access &access, bool &hit)
+{
+    switch (access.type) {
+        case SecWalk::Counter:
+            return sendAtomicMeta(origReq, access.addr, access.size,
+                                  access.isRead, CounterPkt, 0, hit);
+
+        case SecWalk::CounterUpdate:
+            return sendAtomicMeta(origReq, access.addr, access.size,
+                                  access.isRead, CntUpdatePkt, 0, hit);
+
+        case SecWalk::Mac:
+            return sendAtomicMeta(origReq, access.addr, access.size,
+                                  access.isRead, MacPkt, 0, hit);
+
+        case SecWalk::Tree:
+            return sendAtomicMeta(origReq, access.addr, access.size,
+                                  access.isRead, MtPkt, access.level, hit);
+
+        case SecWalk::ReencMac:
+            return sendAtomicMeta(origReq, access.addr, access.size,
+                                  access.isRead, ReencWritePkt, 0, hit);
+
+        case SecWalk::ReencData:
+        {
+            // The contents are kept in the clear, so the block read is
+            // written back as it is
+            PacketPtr pkt = allocPkt(toMem(access.addr), access.size, 0,
+                    origReq->requestorId(),
+                    access.isRead ? MemCmd::ReadReq : MemCmd::WriteReq);
+            if (!access.isRead) pkt->setData(atomicReencData);
+
+            Tick latency = memPort.sendAtomic(pkt);
+            if (access.isRead) pkt->writeData(atomicReencData);
+            releasePkt(pkt);
+
+            hit = false;
+            return latency;
+        }
+
+        default:
+            panic("Unexpected walk access type %d", access.type);
+    }
+}
+
+Tick
+SecCtrl::handleAtomic(PacketPtr pkt)
+{
+    // Keep what is needed before the packet turns into a response
+    RequestPtr req = pkt->req;
+    Addr pkt_addr = toLocal(pkt->getAddr());
+    bool is_read = pkt->isRead();
+    bool hit;
+
+    DPRINTF(SecCtrl, "Atomic access to %#x\n", pkt_addr);
+
+    Tick data_lat = memPort.sendAtomic(pkt);
+
+    if (is_read) {
+        stats.readReqs++;
+    } else {
+        stats.writeReqs++;
+    }
+
+    SecWalk walk(layout, counters, {
+            lazyTreeUpdates,
+            crypto->latency(CryptoEngine::Aes),
+            crypto->latency(CryptoEngine::Mac),
+            crypto->latency(CryptoEngine::Hash),
+            crypto->compareLatency(),
+            cyclesToTicks(macBurstLatency),
+            cyclesToTicks(pinnedLatency)});
+
+    SecWalk::Result result = walk.walk(pkt_addr, is_read, data_lat,
+        [this, &req](const SecWalk::Access &access, bool &cached) {
+            return sendAtomicWalk(req, access, cached);
+        });
+
+    if (!is_read) countCounterUpdate(result.counterUpdate, pkt_addr);
+    stats.reencryptedBlocks += result.reencryptedBlocks;
+    if (result.pinnedAccess) stats.pinnedAccesses++;
+
+    if (macInline) {
+        // The MACs travel with their data
+        if (is_read) {
+            stats.metaBytesRead += macSize;
+        } else {
+            stats.metaBytesWritten +=
+                (1 + result.reencryptedBlocks) * macSize;
+        }
+    }
+
+    // Rehash the parents of the blocks evicted above, which may evict
+    // further blocks in turn
+    while (!treeUpdates.empty()) {
+        TreeUpdate update = treeUpdates.begin()->second;
+        treeUpdates.erase(treeUpdates.begin());
+
+        sendAtomicMeta(req, update.addr, mtSize(false), false,
+                       MtUpdatePkt, update.level, hit);
+    }
+
+    stats.mtWalkDepth.sample(result.levels);
+
+    if (is_read) {
+        stats.readLatency.sample(result.latency);
+    } else {
+        stats.writeLatency.sample(result.latency);
+    }
+
+    return result.latency;
 }
 
 void
 SecCtrl::handleFunctional(PacketPtr pkt)
 {
+    // Buffered writes hold newer data than the memory, and a debug write
+    // updates them as well
+    for (auto it = writeBuffer.rbegin(); it != writeBuffer.rend(); ++it) {
+        if (pkt->trySatisfyFunctional(it->pkt)) {
+            pkt->makeResponse();
+            return;
+        }
+    }
+
     memPort.sendFunctional(pkt);
 }
 
+Addr
+SecCtrl::toLocal(Addr addr) const
+{
+    return memRange.removeIntlvBits(addr);
+}
+
+Addr
+SecCtrl::toMem(Addr addr) const
+{
+    return memRange.addIntlvBits(addr);
+}
+
 AddrRangeList
 SecCtrl::getAddrRanges() const
 {
     // Divide physical memory space for meta data
     DPRINTF(SecCtrl, "Sending new ranges\n");
 
-    AddrRangeList addrRanges = memPort.getAddrRanges();
-    panic_if(addrRanges.size() != 1, "Multiple addresses");
-
-    AddrRange addrRange = addrRanges.front();
-    panic_if(addrRange.interleaved(), "This address is interleaved");
-
-    panic_if(addrRange.start() != 0, "Bad memory space");
-    panic_if(addrRange.end() != mtBorders[MT_LEVEL-1],
-            "Bad memory space");
-
-    AddrRange dataAddrRange = AddrRange(
-            0,
-            cntBorder);
+    AddrRange dataAddrRange = dataRanges.empty() ?
+        AddrRange(0, cntBorder) : dataRanges.front();
 
     DPRINTF(SecCtrl,
             "Original range is %s. New range is %s\n",
-                addrRange.to_string(),
+                memRange.to_string(),
                 dataAddrRange.to_string());
 
     return { dataAddrRange };
@@ -677,9 +2084,257 @@ SecCtrl::getAddrRanges() const
 void
 SecCtrl::handleRangeChange()
 {
+    AddrRangeList addrRanges = memPort.getAddrRanges();
+    panic_if(addrRanges.size() != 1, "Multiple addresses");
+
+    // The metadata is placed in the same channel as its data, so an
+    // interleaved range only needs to hold the metadata of this channel
+    memRange = addrRanges.front();
+
+    panic_if(memRange.start() != 0, "Bad memory space");
+    fatal_if(memRange.size() < mtBorders[mtLevel-1],
+            "Memory %s is too small for %#x bytes of protected data, "
+            "%#x bytes are required", memRange.to_string(), dataSpace,
+            mtBorders[mtLevel-1]);
+    fatal_if(memRange.interleaved() && dataRanges.empty(),
+             "Interleaved memory %s needs data_ranges",
+             memRange.to_string());
+
     cpuSidePort.sendRangeChange();
 }
 
+DrainState
+SecCtrl::drain()
+{
+    // Buffered writes only count once they are in memory
+    drainWriteBuffer(true);
+
+    if (isBusy()) {
+        DPRINTF(Drain, "SecCtrl not drained, %d transactions in flight\n",
+                transactions.size() - freeTransactions.size());
+        return DrainState::Draining;
+    }
+
+    return DrainState::Drained;
+}
+
+void
+SecCtrl::drainResume()
+{
+    // A requestor may have been rejected while draining
+    cpuSidePort.trySendRetryReq();
+}
+
+void
+SecCtrl::serialize(CheckpointOut &cp) const
+{
+    // Refuse to restore counters into a different layout
+    SERIALIZE_SCALAR(cntsPerBlock);
+
+    std::vector<Addr> cnt_blocks;
+    std::vector<uint64_t> majors;
+    std::vector<uint8_t> zcc;
+    std::vector<uint16_t> minors;
+
+    for (const auto &entry : counters.blocks()) {
+        cnt_blocks.push_back(entry.first);
+        majors.push_back(entry.second.major);
+        zcc.push_back(entry.second.zcc);
+        minors.insert(minors.end(), entry.second.minors.begin(),
+                      entry.second.minors.end());
+    }
+
+    SERIALIZE_CONTAINER(cnt_blocks);
+    SERIALIZE_CONTAINER(majors);
+    SERIALIZE_CONTAINER(zcc);
+    SERIALIZE_CONTAINER(minors);
+}
+
+void
+SecCtrl::unserialize(CheckpointIn &cp)
+{
+    unsigned cnts_per_block;
+    paramIn(cp, "cntsPerBlock", cnts_per_block);
+    fatal_if(cnts_per_block != cntsPerBlock,
+             "Checkpoint has %d counters per block, not %d",
+             cnts_per_block, cntsPerBlock);
+
+    std::vector<Addr> cnt_blocks;
+    std::vector<uint64_t> majors;
+    std::vector<uint8_t> zcc;
+    std::vector<uint16_t> minors;
+
+    UNSERIALIZE_CONTAINER(cnt_blocks);
+    UNSERIALIZE_CONTAINER(majors);
+    UNSERIALIZE_CONTAINER(zcc);
+    UNSERIALIZE_CONTAINER(minors);
+
+    fatal_if(majors.size() != cnt_blocks.size() ||
+             zcc.size() != cnt_blocks.size() ||
+             minors.size() != cnt_blocks.size() * cntsPerBlock,
+             "Inconsistent counter blocks in the checkpoint");
+
+    counters.clear();
+    for (size_t i=0; i<cnt_blocks.size(); i++) {
+        auto first = minors.begin() + i * cntsPerBlock;
+        counters.setBlock(cnt_blocks[i], SecCounters::Block{majors[i],
+            std::vector<uint16_t>(first, first + cntsPerBlock),
+            zcc[i] != 0});
+    }
+}
+
+SecCtrl::SecCtrlStats::SecCtrlStats(SecCtrl &_ctrl)
+    : statistics::Group(&_ctrl),
+    ctrl(_ctrl),
+
+    ADD_STAT(readReqs, statistics::units::Count::get(),
+             "Number of read requests accepted"),
+    ADD_STAT(writeReqs, statistics::units::Count::get(),
+             "Number of write requests accepted"),
+
+    ADD_STAT(readLatency, statistics::units::Tick::get(),
+             "Read latency from acceptance to verified response"),
+    ADD_STAT(writeLatency, statistics::units::Tick::get(),
+             "Write latency from acceptance to finished verification"),
+
+    ADD_STAT(counterHits, statistics::units::Count::get(),
+             "Counter accesses hitting in the metadata cache"),
+    ADD_STAT(counterMisses, statistics::units::Count::get(),
+             "Counter accesses missing in the metadata cache"),
+    ADD_STAT(counterHitRate, statistics::units::Ratio::get(),
+             "Counter hit rate in the metadata cache"),
+    ADD_STAT(macHits, statistics::units::Count::get(),
+             "MAC accesses hitting in the metadata cache"),
+    ADD_STAT(macMisses, statistics::units::Count::get(),
+             "MAC accesses missing in the metadata cache"),
+    ADD_STAT(macHitRate, statistics::units::Ratio::get(),
+             "MAC hit rate in the metadata cache"),
+    ADD_STAT(mtHits, statistics::units::Count::get(),
+             "Tree node accesses hitting in the metadata cache per level"),
+    ADD_STAT(mtMisses, statistics::units::Count::get(),
+             "Tree node accesses missing in the metadata cache per level"),
+    ADD_STAT(mtHitRate, statistics::units::Ratio::get(),
+             "Tree node hit rate in the metadata cache per level"),
+
+    ADD_STAT(metaMisses, statistics::units::Count::get(),
+             "Metadata accesses missing in the metadata cache"),
+    ADD_STAT(conflictMisses, statistics::units::Count::get(),
+             "Metadata misses a fully associative cache would have hit"),
+    ADD_STAT(conflictMissRatio, statistics::units::Ratio::get(),
+             "Fraction of the metadata misses which are conflict misses"),
+
+    ADD_STAT(mtWalkDepth, statistics::units::Count::get(),
+             "Tree levels fetched per transaction"),
+    ADD_STAT(pinnedAccesses, statistics::units::Count::get(),
+             "Tree walks which reached the pinned levels or the root"),
+    ADD_STAT(aheadTreeFetches, statistics::units::Count::get(),
+             "Tree nodes read walks fetched before knowing they need them"),
+    ADD_STAT(wastedTreeFetches, statistics::units::Count::get(),
+             "Tree nodes read walks fetched above a cached node"),
+    ADD_STAT(wastedFetchRatio, statistics::units::Ratio::get(),
+             "Fraction of the tree nodes fetched ahead which were wasted"),
+
+    ADD_STAT(rejectedReqs, statistics::units::Count::get(),
+             "Requests rejected by the CPU side port"),
+    ADD_STAT(rejectedCycles, statistics::units::Cycle::get(),
+             "Cycles the CPU side port spent rejecting requests"),
+
+    ADD_STAT(metaBytesRead, statistics::units::Byte::get(),
+             "Bytes of metadata read, inline MACs included"),
+    ADD_STAT(metaBytesWritten, statistics::units::Byte::get(),
+             "Bytes of metadata written, inline MACs included"),
+
+    ADD_STAT(counterOverflows, statistics::units::Count::get(),
+             "Minor counter overflows"),
+    ADD_STAT(counterReencodings, statistics::units::Count::get(),
+             "Morphable counter blocks switching their format"),
+    ADD_STAT(reencryptedBlocks, statistics::units::Count::get(),
+             "Data blocks re-encrypted after a counter overflow"),
+
+    ADD_STAT(evictionUpdates, statistics::units::Count::get(),
+             "Tree nodes rehashed on the eviction of a child"),
+
+    ADD_STAT(padStalls, statistics::units::Count::get(),
+             "Reads whose data arrived before its pad was generated"),
+
+    ADD_STAT(speculativeReads, statistics::units::Count::get(),
+             "Reads sent to the CPU before their verification finished"),
+    ADD_STAT(speculationStalls, statistics::units::Count::get(),
+             "Reads which waited for verification as the window was full"),
+    ADD_STAT(verificationLag, statistics::units::Tick::get(),
+             "Ticks verification finished after speculative data was sent"),
+
+    ADD_STAT(bufferedWrites, statistics::units::Count::get(),
+             "Writes acknowledged once put into the write buffer"),
+    ADD_STAT(mergedWrites, statistics::units::Count::get(),
+             "Writes merged with a buffered write of the same block"),
+    ADD_STAT(forwardedReads, statistics::units::Count::get(),
+             "Reads served by the write buffer"),
+    ADD_STAT(writeBufferFull, statistics::units::Count::get(),
+             "Writes rejected as the write buffer was full"),
+    ADD_STAT(writeBufferOccupancy, statistics::units::Rate<
+                statistics::units::Count, statistics::units::Tick>::get(),
+             "Average number of writes in the write buffer"),
+
+    ADD_STAT(scheduledEvents, statistics::units::Count::get(),
+             "Events scheduled by the controller"),
+    ADD_STAT(eventsPerRequest, statistics::units::Ratio::get(),
+             "Events scheduled per accepted request"),
+    ADD_STAT(hostRequestTime, statistics::units::Second::get(),
+             "Host time spent handling requests"),
+    ADD_STAT(hostResponseTime, statistics::units::Second::get(),
+             "Host time spent handling responses"),
+    ADD_STAT(hostResponses, statistics::units::Count::get(),
+             "Responses handled while measuring the host time"),
+    ADD_STAT(hostTimePerRequest, statistics::units::Rate<
+                statistics::units::Second, statistics::units::Count>::get(),
+             "Host time per accepted request"),
+    ADD_STAT(hostTimePerResponse, statistics::units::Rate<
+                statistics::units::Second, statistics::units::Count>::get(),
+             "Host time per handled response")
+{
+}
+
+void
+SecCtrl::SecCtrlStats::regStats()
+{
+    using namespace statistics;
+
+    statistics::Group::regStats();
+
+    readLatency.init(16);
+    writeLatency.init(16);
+    verificationLag.init(16);
+
+    counterHitRate = counterHits / (counterHits + counterMisses);
+    macHitRate = macHits / (macHits + macMisses);
+
+    mtHits.init(ctrl.mtLevel-1);
+    mtMisses.init(ctrl.mtLevel-1);
+    for (uint8_t i=0; i<ctrl.mtLevel-1; i++) {
+        mtHits.subname(i, "level" + std::to_string(i));
+        mtMisses.subname(i, "level" + std::to_string(i));
+    }
+    mtHitRate.flags(nozero | nonan);
+    mtHitRate = mtHits / (mtHits + mtMisses);
+
+    conflictMissRatio.flags(nozero | nonan);
+    conflictMissRatio = conflictMisses / metaMisses;
+
+    mtWalkDepth.init(0, ctrl.mtLevel-1, 1);
+
+    wastedFetchRatio.flags(nozero | nonan);
+    wastedFetchRatio = wastedTreeFetches / aheadTreeFetches;
+
+    eventsPerRequest.flags(nozero | nonan);
+    eventsPerRequest = scheduledEvents / (readReqs + writeReqs);
+
+    hostTimePerRequest.flags(nozero | nonan);
+    hostTimePerRequest = hostRequestTime / (readReqs + writeReqs);
+    hostTimePerResponse.flags(nozero | nonan);
+    hostTimePerResponse = hostResponseTime / hostResponses;
+}
+
 Port &
 SecCtrl::getPort(const std::string &if_name, PortID idx)
 {
@@ -692,9 +2347,13 @@ SecCtrl::getPort(const std::string &if_name, PortID idx)
         return memPort;
     } else if (if_name == "meta_port") {
         return metaPort;
+    } else if (if_name == "evict_side_port") {
+        return evictSidePort;
+    } else if (if_name == "evict_mem_port") {
+        return evictMemPort;
     } else {
         // pass it along to our super class
-        return SimObject::getPort(if_name, idx);
+        return ClockedObject::getPort(if_name, idx);
     }
 }
 
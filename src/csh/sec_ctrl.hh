@@ -1,29 +1,183 @@
 #ifndef __CSH_SEC_CTRL_HH__
 #define __CSH_SEC_CTRL_HH__
 
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/output.hh"
+#include "base/statistics.hh"
+#include "csh/crypto_engine.hh"
+#include "csh/meta_prefetcher.hh"
+#include "csh/sec_counters.hh"
+#include "csh/sec_layout.hh"
+#include "csh/sec_walk.hh"
+#include "enums/SecCounterEncoding.hh"
+#include "enums/SecCounterMode.hh"
+
 #include "mem/port.hh"
 #include "mem/request.hh"
 #include "params/SecCtrl.hh"
-#include "sim/sim_object.hh"
-
-#define DATA_SPACE 0x200000000
-#define NODE_SPACE 0x40
-#define MT_LEVEL 7 // Actually, Level 8
-#define MAC_CYCLE 80
-#define HASH_CYCLE 80
+#include "sim/clocked_object.hh"
 
 namespace gem5
 {
 
-class SecCtrl : public SimObject
+class SecCtrl : public ClockedObject
 {
   private:
 
-    enum State
+    /**
+     * Kind of packet the controller issues on behalf of a transaction.
+     */
+    enum PktType
+    {
+        DataPkt,
+        CounterPkt,
+        MacPkt,
+        MtPkt,
+        // Not waited for by the transaction that issued them
+        CntUpdatePkt,
+        MtUpdatePkt,
+        ReencReadPkt,
+        ReencWritePkt,
+        PrefetchPkt
+    };
+
+    /**
+     * Attached to every packet sent for a transaction, so that its
+     * response can be matched back without comparing addresses.
+     */
+    struct SecSenderState : public Packet::SenderState
     {
-        Idle,
-        Read,
-        Write
+        uint16_t txnId;
+        PktType type;
+        uint8_t level;
+        /// Data access the packet is sent for, MaxAddr if none
+        Addr dataAddr;
+        /// Transaction of the entry the packet was sent for
+        uint64_t txnSeq;
+
+        SecSenderState(uint16_t _txnId, PktType _type, uint8_t _level,
+                       Addr _dataAddr=MaxAddr, uint64_t _txnSeq=0) :
+            txnId(_txnId), type(_type), level(_level), dataAddr(_dataAddr),
+            txnSeq(_txnSeq)
+        {}
+    };
+
+    /**
+     * Header of a metadata trace file, followed by one record per
+     * metadata access in the order of the responses. All fields are
+     * little endian.
+     */
+    struct MetaTraceHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+    };
+
+    /**
+     * Metadata access in a trace. Addresses are channel-local, type is
+     * the PktType and level the tree level of a node.
+     */
+    struct MetaTraceRecord
+    {
+        /// Tick the access was sent
+        uint64_t tick;
+        uint64_t addr;
+        /// Data access it was sent for, MaxAddr if none
+        uint64_t dataAddr;
+        /// Ticks until the response
+        uint32_t latency;
+        uint8_t type;
+        uint8_t level;
+        uint8_t isWrite;
+        /// Cache levels below the metadata port it went through
+        uint8_t depth;
+    };
+
+    /**
+     * One entry of the transaction table, i.e. a CPU request being
+     * verified together with all the metadata it is waiting for.
+     */
+    struct Transaction
+    {
+        const uint16_t id;
+
+        bool valid;
+        bool isRead;
+
+        /// Tells the transactions of the entry apart
+        uint64_t seq;
+
+        /**
+         * Information of the packet being verified
+         */
+        Addr verifiedPktAddr;
+        Addr verifiedCntOffs;
+        uint32_t flags;
+        uint16_t requestorId;
+        bool needsResponse;
+
+        Tick chargeTime;
+
+        /// When the request was accepted, buffered for a posted write
+        Tick startTime;
+
+        /// When the data access was sent
+        Tick issueTime;
+
+        /// When the pad and the MAC of the data are available
+        Tick padTime;
+        Tick macTime;
+
+        /// Whether the stored MAC was read, or the new one written
+        bool macDone;
+
+        /// Write acknowledged when it was buffered, nobody gets its response
+        bool posted;
+
+        /// When the data went to the CPU ahead of its verification
+        Tick forwardTime;
+        bool forwarded;
+
+        /// Only a marker of the arrival once speculatively forwarded
+        PacketPtr responsePkt;
+
+        PacketPtr counterPkt;
+        PacketPtr macPkt;
+
+        // Merkle Tree nodes without root
+        std::vector<PacketPtr> mtPkts;
+
+        /**
+         * Stored levels a read walk has fetched, and verified in order
+         * from the counter up. Levels above a cached node are wasted.
+         */
+        uint8_t mtIssued;
+        uint8_t mtVerified;
+
+        /// A write walk waits for the read of a node which missed
+        bool mtReadPending;
+
+        EventFunctionWrapper forwardData;
+        EventFunctionWrapper readVerFinished;
+        EventFunctionWrapper sendMacWrite;
+        EventFunctionWrapper sendNextMtWrite;
+        EventFunctionWrapper writeVerFinished;
+
+        Transaction(SecCtrl *ctrl, uint16_t _id);
+
+        /**
+         * Return the entry to the idle state.
+         */
+        void reset();
     };
 
     /**
@@ -38,8 +192,8 @@ class SecCtrl : public SimObject
         /// True if the port needs to send a retry req.
         bool needRetry;
 
-        /// If we tried to send a packet and it was blocked, store it here
-        PacketPtr blockedPacket;
+        /// Responses which could not be sent yet, in sending order
+        std::deque<PacketPtr> blockedPackets;
 
       public:
         /**
@@ -48,18 +202,21 @@ class SecCtrl : public SimObject
         CPUSidePort(const std::string& name, SecCtrl *_ctrl) :
             ResponsePort(name, _ctrl),
             ctrl(_ctrl),
-            needRetry(false),
-            blockedPacket(nullptr)
+            needRetry(false)
         {}
 
         /**
          * Send a packet across this port. This is called by the owner and
-         * all of the flow control is hanled in this function.
+         * all of the flow control is hanled in this function. A packet
+         * that cannot be sent now is queued and sent on the next retry.
          *
          * @param packet to send.
          */
         bool sendPacket(PacketPtr pkt);
 
+        /// True if responses are waiting for a retry from the peer.
+        bool blocked() const { return !blockedPackets.empty(); }
+
         /**
          * Send a retry to the peer port only if it is needed. This is called
          * from the SimpleMemobj whenever it is unblocked.
@@ -78,10 +235,12 @@ class SecCtrl : public SimObject
       protected:
         /**
          * Receive an atomic request packet from the request port.
-         * No need to implement in this simple memobj.
+         * The metadata is accessed atomically as well.
+         *
+         * @param packet the requestor sent.
+         * @return the latency of the secure access
          */
-        Tick recvAtomic(PacketPtr pkt) override
-        { panic("recvAtomic unimpl."); }
+        Tick recvAtomic(PacketPtr pkt) override;
 
         /**
          * Receive a functional request packet from the request port.
@@ -118,8 +277,8 @@ class SecCtrl : public SimObject
         /// The ctrl that owns this object (SecCtrl)
         SecCtrl *ctrl;
 
-        /// If we tried to send a packet and it was blocked, store it here
-        PacketPtr blockedPacket;
+        /// Requests which could not be sent yet, in sending order
+        std::deque<PacketPtr> blockedPackets;
 
       public:
         /**
@@ -127,13 +286,13 @@ class SecCtrl : public SimObject
          */
         MemSidePort(const std::string& name, SecCtrl *_ctrl) :
             RequestPort(name, _ctrl),
-            ctrl(_ctrl),
-            blockedPacket(nullptr)
+            ctrl(_ctrl)
         {}
 
         /**
          * Send a packet across this port. This is called by the owner and
-         * all of the flow control is hanled in this function.
+         * all of the flow control is hanled in this function. A packet
+         * that cannot be sent now is queued and sent on the next retry.
          *
          * @param packet to send.
          */
@@ -162,19 +321,259 @@ class SecCtrl : public SimObject
         void recvRangeChange() override;
     };
 
+    /**
+     * Port receiving the traffic the metadata cache sends to memory. It
+     * passes everything on, but watches the dirty evictions to update
+     * the tree lazily.
+     */
+    class EvictSidePort : public ResponsePort
+    {
+      private:
+        /// The ctrl that owns this object (SecCtrl)
+        SecCtrl *ctrl;
+
+      public:
+        /**
+         * Constructor. Just calls the superclass constructor.
+         */
+        EvictSidePort(const std::string& name, SecCtrl *_ctrl) :
+            ResponsePort(name, _ctrl),
+            ctrl(_ctrl)
+        {}
+
+        AddrRangeList getAddrRanges() const override;
+
+      protected:
+        Tick recvAtomic(PacketPtr pkt) override;
+        void recvFunctional(PacketPtr pkt) override;
+        bool recvTimingReq(PacketPtr pkt) override;
+        void recvRespRetry() override;
+    };
+
+    /**
+     * Port forwarding the metadata cache traffic to memory.
+     */
+    class EvictMemPort : public RequestPort
+    {
+      private:
+        /// The ctrl that owns this object (SecCtrl)
+        SecCtrl *ctrl;
+
+      public:
+        /**
+         * Constructor. Just calls the superclass constructor.
+         */
+        EvictMemPort(const std::string& name, SecCtrl *_ctrl) :
+            RequestPort(name, _ctrl),
+            ctrl(_ctrl)
+        {}
+
+      protected:
+        bool recvTimingResp(PacketPtr pkt) override;
+        void recvReqRetry() override;
+        void recvRangeChange() override;
+    };
+
+    /**
+     * Update of a tree node waiting for the hash of its child.
+     */
+    struct TreeUpdate
+    {
+        Addr addr;
+        uint8_t level;
+        RequestorID requestorId;
+    };
+
     /**
      * Utility
      */
-    void updateChargeTime(Tick newChargeTime);
+    void updateChargeTime(Transaction &txn, Tick newChargeTime);
+
+    /**
+     * Get a packet with a pooled request and payload of at most
+     * NODE_SPACE bytes.
+     */
+    PacketPtr allocPkt(Addr addr, unsigned size, Request::Flags flags,
+                       RequestorID requestorId, MemCmd cmd);
+
+    /**
+     * Return a packet obtained from allocPkt, and its payload, to the
+     * pool.
+     */
+    void releasePkt(PacketPtr pkt);
 
     PacketPtr createMetaPkt(
+            Transaction &txn,
             Addr addr,
             unsigned size,
-            bool isRead);
+            bool isRead,
+            PktType type,
+            uint8_t level);
+
+    /**
+     * Metadata address mapping of a data block, see SecLayout
+     */
+    Addr counterOffset(Addr pktAddr) const
+    { return layout.counterOffset(pktAddr); }
+    Addr cntAddr(Addr cntOffs) const { return layout.cntAddr(cntOffs); }
+    unsigned cntSize() const { return layout.cntSize(); }
+    Addr macAddr(Addr pktAddr) const { return layout.macAddr(pktAddr); }
+    Addr mtAddr(Addr cntOffs, uint8_t nth, bool isRead) const
+    { return layout.mtAddr(cntOffs, nth, isRead); }
+    unsigned mtSize(bool isRead) const { return layout.mtSize(isRead); }
+    bool parentNode(Addr addr, Addr &parent, uint8_t &level) const
+    { return layout.parentNode(addr, parent, level); }
+
+    /**
+     * Latency of accessing an on-chip tree level, the root register is
+     * free.
+     */
+    Tick onChipLatency(uint8_t level) const;
+
+    /**
+     * Send a packet through the metadata port and account its bytes.
+     */
+    bool sendMetaPkt(PacketPtr pkt);
+
+    bool sendCntPkt(Transaction &txn, bool isRead);
+    bool sendTreeUpdatePkt(const TreeUpdate &update);
 
-    bool sendCntPkt(bool isRead);
-    bool sendMacPkt(bool isRead);
-    bool sendMtPkt(uint8_t nth, bool isRead);
+    /**
+     * Send a re-encryption access.
+     *
+     * @param data payload of a write, null if the contents do not matter
+     */
+    bool sendReencPkt(Addr addr, unsigned size, bool isRead, PktType type,
+                      RequestorID requestorId,
+                      const uint8_t *data=nullptr);
+    bool sendPrefetchPkt(Addr blk, RequestorID requestorId);
+
+    /**
+     * Prefetch the counter and MAC blocks of the data the prefetcher
+     * expects after an access. Tree nodes are left to the demand walk,
+     * as a cached node is trusted without verification.
+     */
+    void prefetchMetadata(Addr pktAddr, RequestorID requestorId);
+
+    /**
+     * Increment the counter of the written block, see SecCounters.
+     *
+     * @return true if the covered blocks must be re-encrypted
+     */
+    bool incrementCounter(Addr pktAddr);
+
+    /**
+     * Count what a write did to its counter.
+     *
+     * @return true if the covered blocks must be re-encrypted
+     */
+    bool countCounterUpdate(SecCounters::Update update, Addr pktAddr);
+
+    /**
+     * Read and write back every data block covered by a counter block
+     * together with its MAC.
+     */
+    void reencryptCounterBlock(Addr cntBlk, RequestorID requestorId);
+
+    /**
+     * Note a CPU write of data, which is newer than the data of any
+     * re-encryption read of the same blocks still on its way.
+     */
+    void noteDataWrite(Addr addr, unsigned size);
+    bool sendMacPkt(Transaction &txn, bool isRead);
+    bool sendMtPkt(Transaction &txn, uint8_t nth, bool isRead);
+
+    /**
+     * Whether the tree walk of the transaction has reached a cached
+     * node (or the last stored level) with all nodes below it arrived.
+     */
+    bool mtWalkFinished(const Transaction &txn) const;
+
+    /**
+     * Fetch the tree levels of a read walk up to the window above the
+     * first level it needs.
+     */
+    void fetchTreeLevels(Transaction &txn, uint8_t first);
+
+    /**
+     * Hash the fetched tree nodes of a read walk in order from the
+     * counter up, until a cached node or a missing one, and fetch the
+     * levels the walk turns out to need.
+     *
+     * @return whether any node was verified
+     */
+    bool verifyTreeLevels(Transaction &txn);
+
+    /**
+     * Whether any request, or the given one, could be accepted right
+     * now.
+     */
+    bool canAcceptRequest() const;
+    bool canAcceptRequest(PacketPtr pkt) const;
+
+    /**
+     * Take a free entry of the transaction table for the request and
+     * send its data and first metadata accesses.
+     *
+     * @param posted whether the write was already acknowledged
+     * @param acceptTime when the request was accepted
+     */
+    void startTransaction(PacketPtr pkt, bool posted, Tick acceptTime);
+
+    /**
+     * The newest buffered write overlapping the request, if any.
+     */
+    PacketPtr findBufferedWrite(PacketPtr pkt) const;
+
+    /**
+     * Put a write into the write buffer, merging it with a buffered
+     * write of the same block, and acknowledge it.
+     */
+    void bufferWrite(PacketPtr pkt);
+
+    /**
+     * Whether the oldest buffered write should start its verification.
+     * Reads go first unless the buffer is filling up.
+     *
+     * @param force drain no matter the reads in flight
+     */
+    bool canDrainWrite(bool force) const;
+    void drainWriteBuffer(bool force=false);
+
+    /**
+     * Send the response to a request served by the write buffer on the
+     * next cycle.
+     */
+    void respondFromBuffer(PacketPtr pkt);
+    void processBufferResponses();
+
+    /**
+     * Retry a rejected requestor once the crypto queue has room again.
+     */
+    void waitForCrypto();
+    void processCryptoRetry();
+
+    /**
+     * Release a finished transaction and wake up a waiting requestor.
+     */
+    void freeTransaction(Transaction &txn);
+
+    /**
+     * Whether any transaction, response or background packet is still
+     * in flight.
+     */
+    bool isBusy() const;
+
+    /**
+     * Signal that draining is done once nothing is in flight anymore.
+     */
+    void checkDrain();
+
+    /**
+     * Schedule an event of the controller, counting it.
+     */
+    void scheduleEvent(Event &event, Tick when);
+    void rescheduleEvent(Event &event, Tick when, bool always=false);
 
     /**
      * Handle the request from the CPU side
@@ -183,7 +582,7 @@ class SecCtrl : public SimObject
      * @return true if we can handle the request this cycle, false if the
      *         requestor needs to retry later
      */
-    void handleRequest(PacketPtr pkt);
+    bool handleRequest(PacketPtr pkt);
 
     /**
      * Handle the respone from the memory side
@@ -194,6 +593,32 @@ class SecCtrl : public SimObject
      */
     void handleResponse(PacketPtr pkt);
 
+    /**
+     * Handle a packet atomically. Counter, MAC and tree nodes are
+     * accessed through the metadata port as well, so that the metadata
+     * cache warms up during fast-forwarding.
+     *
+     * @param packet to atomically handle
+     * @return the latency the timing path would model
+     */
+    Tick handleAtomic(PacketPtr pkt);
+
+    /**
+     * Atomically access a piece of metadata for a request.
+     *
+     * @param hit set to whether the metadata cache held it
+     * @return the latency of the access
+     */
+    Tick sendAtomicMeta(const RequestPtr &origReq, Addr addr, unsigned size,
+                        bool isRead, PktType type, uint8_t level, bool &hit);
+
+    /**
+     * Make an access of the atomic metadata walk of a request, see
+     * SecWalk.
+     */
+    Tick sendAtomicWalk(const RequestPtr &origReq,
+                        const SecWalk::Access &access, bool &hit);
+
     /**
      * Handle a packet functionally. Update the data on a write and get the
      * data on a read.
@@ -208,51 +633,344 @@ class SecCtrl : public SimObject
     AddrRangeList getAddrRanges() const;
 
     /**
-     * Tell the CPU side to ask for our memory ranges.
+     * Translate between memory addresses and the addresses within the
+     * channel, where data and metadata are laid out.
+     */
+    Addr toLocal(Addr addr) const;
+    Addr toMem(Addr addr) const;
+
+    /**
+     * Learn the range of the memory, and tell the CPU side to ask for
+     * our memory ranges.
      */
     void handleRangeChange();
 
-    void processReadVerFinished();
-    EventFunctionWrapper readVerFinished;
+    /**
+     * Account the metadata cache hit or miss of a response.
+     */
+    void recordMetaAccess(PacketPtr pkt, PktType type, uint8_t level);
 
-    void processSendMacWrite();
-    EventFunctionWrapper sendMacWrite;
+    /**
+     * Append a metadata access to the trace, if there is one.
+     */
+    void traceMetaAccess(PacketPtr pkt, PktType type, uint8_t level,
+                         Addr dataAddr, Tick latency);
 
-    void processSendNextMtWrite();
-    EventFunctionWrapper sendNextMtWrite;
+    /**
+     * Write the buffered trace records to the trace file.
+     */
+    void flushTrace();
 
-    void processWriteVerFinished();
-    EventFunctionWrapper writeVerFinished;
+    /**
+     * Put a span, or an instant if it is one, on a track of the
+     * timeline of a transaction entry.
+     */
+    void timelineEvent(const Transaction &txn, unsigned track,
+                       const char *name, Tick start, Tick end,
+                       bool instant=false);
+
+    /**
+     * Put the fetch of a response on the timeline, from the tick it
+     * was sent.
+     */
+    void timelineAccess(const Transaction &txn, PacketPtr pkt, PktType type,
+                        uint8_t level);
+
+    /**
+     * Write the buffered timeline events to the timeline file, closing
+     * the JSON array if it is the end.
+     */
+    void flushTimeline(bool last);
+
+    /**
+     * Reserve the hash of a counter block or tree node verified or
+     * updated by a transaction, putting it on the timeline.
+     *
+     * @param level tree level of a node
+     * @return tick the hash is done
+     */
+    Tick reserveHash(const Transaction &txn, PktType type, uint8_t level,
+                     Tick ready);
+
+    /**
+     * Look a metadata block up in the shadow cache, counting a conflict
+     * miss if only the shadow holds it, and make it most recently used.
+     */
+    void recordShadowAccess(Addr addr, bool hit);
+
+    void handleBackgroundResponse(PacketPtr pkt, PktType type);
+
+    /**
+     * Rehash the parent of a dirty counter block or node the metadata
+     * cache writes back, in lazy tree update mode.
+     *
+     * @param addr address of the written back block
+     * @param atomic whether the update is sent by the atomic access
+     *        that caused the eviction instead of an event
+     */
+    void handleEviction(Addr addr, RequestorID requestorId, bool atomic);
+    void processTreeUpdates();
+    void handleReadResponse(Transaction &txn, PacketPtr pkt,
+                            PktType type, uint8_t level);
+    void handleWriteResponse(Transaction &txn, PacketPtr pkt,
+                             PktType type, uint8_t level);
+
+    /**
+     * Send the decrypted data of a read to the CPU while its
+     * verification is still going on.
+     */
+    void processForwardData(Transaction &txn);
+    void processReadVerFinished(Transaction &txn);
+    void processSendMacWrite(Transaction &txn);
+    void processSendNextMtWrite(Transaction &txn);
+    void processWriteVerFinished(Transaction &txn);
 
 
     CPUSidePort cpuSidePort;
     MemSidePort memPort;
     MemSidePort metaPort;
+    EvictSidePort evictSidePort;
+    EvictMemPort evictMemPort;
+
+    /**
+     * Geometry of the protected memory
+     */
+    const Addr dataSpace;
+    /// Interleaved range of the data of this channel, if any
+    const std::vector<AddrRange> dataRanges;
+    /// Range of the memory behind, holding data and metadata
+    AddrRange memRange;
+    /// Where the metadata is, the geometry below is copied from it
+    const SecLayout layout;
+    /// Data blocks covered by a counter block
+    unsigned cntsPerBlock;
+    /// Bytes of MAC per data block
+    const unsigned macSize;
+    /**
+     * Whether MACs travel in the ECC or side-band bits of their data
+     * block instead of a region of their own, at some extra burst cycles
+     */
+    const bool macInline;
+    const Cycles macBurstLatency;
+    /// Children per Merkle Tree node
+    const unsigned mtArity;
+    /// Tree levels above the counters, the last one is the on-chip root
+    uint8_t mtLevel;
+
+    /**
+     * Top stored tree levels kept in on-chip SRAM, which is trusted and
+     * ends every walk. pinnedLevel is the first of them, or the root.
+     */
+    const unsigned pinnedLevels;
+    uint8_t pinnedLevel;
+    const Cycles pinnedLatency;
 
-    State state;
+    /// Tree levels a read walk fetches ahead, 0 for all of them
+    const unsigned treeFetchWindow;
+    /// Sequence number of the next transaction
+    uint64_t nextTxnSeq;
+    /// Fetches of finished walks still on their way back
+    unsigned numOrphanFetches;
 
-    Tick chargeTime;
+    /// Units hashing tree nodes, computing MACs and generating pads
+    CryptoEngine *crypto;
+
+    /// Predicts the data blocks whose metadata is fetched early, if any
+    MetaPrefetcher *prefetcher;
+    std::vector<Addr> prefetchAddrs;
+
+    Addr cntBorder;
+    Addr macBorder;
+    std::vector<Addr> mtBorders;
 
     /**
-     * Information of the packet being verified
+     * Fully associative LRU cache of the capacity of the metadata
+     * cache, most recently used block first. Its misses are the
+     * capacity and compulsory ones, anything beyond is a conflict miss.
      */
-    Addr verifiedPktAddr;
-    Addr verifiedCntOffs;
-    uint32_t flags;
-    uint16_t requestorId;
-    bool needsResponse;
+    const size_t shadowCapacity;
+    std::list<Addr> shadowBlocks;
+    std::unordered_map<Addr, std::list<Addr>::iterator> shadowIndex;
 
-    mutable Addr cntBorder;
-    mutable Addr macBorder;
-    mutable Addr mtBorders[MT_LEVEL];
+    /// Counters of the data blocks written so far
+    SecCounters counters;
 
-    PacketPtr responsePkt;
+    /**
+     * Data blocks being re-encrypted, by block number. A block the CPU
+     * writes meanwhile is not written back, as the write-back would
+     * overwrite the newer data with the one read before.
+     */
+    struct ReencBlock
+    {
+        unsigned pendingReads;
+        bool overwritten;
+    };
+    std::unordered_map<Addr, ReencBlock> reencBlocks;
+
+    /// Block an atomic re-encryption read, to be written back as read
+    uint8_t atomicReencData[NODE_SPACE];
 
-    PacketPtr counterPkt;
-    PacketPtr macPkt;
+    /**
+     * Transaction table. Every entry is an independent secure access
+     * doing its own counter/MAC/tree walk.
+     */
+    std::vector<std::unique_ptr<Transaction>> transactions;
+
+    /// Indices of the idle entries of the transaction table
+    std::vector<uint16_t> freeTransactions;
+
+    /**
+     * Pool of metadata packets. A released packet is destroyed in place
+     * and later rebuilt in the same storage, and its payload is one of
+     * the pooled buffers, so the host allocator is only hit while the
+     * pool grows to the peak number of packets in flight.
+     */
+    std::vector<void *> freePkts;
+    std::vector<RequestPtr> freeRequests;
+    std::vector<uint8_t *> freeBuffers;
+
+    /// Counter updates and re-encryption packets waiting for a response
+    unsigned numBackgroundPkts;
+
+    /**
+     * Whether written counters and nodes only get dirty in the metadata
+     * cache, with their parents rehashed on eviction
+     */
+    const bool lazyTreeUpdates;
+
+    /// Parent updates waiting for their hash, by the tick it is done
+    std::multimap<Tick, TreeUpdate> treeUpdates;
+    EventFunctionWrapper treeUpdateEvent;
+
+    /**
+     * Read responses which may be sent before their verification
+     * finishes, 0 disables speculation
+     */
+    const unsigned speculationWindow;
+    unsigned numUnverified;
+
+    /**
+     * Writes acknowledged as soon as they are buffered, oldest first.
+     * Their counter, MAC and tree updates start in the background.
+     */
+    const unsigned writeBufferSize;
+    /// Occupancy above which writes no longer wait for the reads
+    const unsigned writeHighThresh;
+
+    struct BufferedWrite
+    {
+        PacketPtr pkt;
+        /// When the write was acknowledged, a merged one keeping the tick
+        /// of the first
+        Tick acceptTime;
+    };
+    std::deque<BufferedWrite> writeBuffer;
 
-    // Merkle Tree nodes without root
-    PacketPtr mtPkts[MT_LEVEL-1];
+    /// A read is waiting for a partly overlapping write to drain
+    bool readStalled;
+    unsigned numActiveReads;
+
+    /// Responses of requests served by the write buffer, by send tick
+    std::deque<std::pair<Tick, PacketPtr>> bufferResponses;
+    EventFunctionWrapper bufferRespEvent;
+
+    /// Merged write kept until the requestor has let go of it
+    std::unique_ptr<Packet> pendingDelete;
+
+    /**
+     * Binary trace of the metadata accesses, null when disabled. The
+     * records are written in large chunks to keep tracing cheap.
+     */
+    OutputStream *traceStream;
+    std::vector<MetaTraceRecord> traceBuffer;
+
+    /**
+     * Chrome trace event JSON of the transactions, null when disabled.
+     * Every transaction entry has a group of tracks, one per kind of
+     * access, so that the overlapping accesses stay apart.
+     */
+    OutputStream *timelineStream;
+    std::string timelineBuffer;
+    /// Tracks per transaction entry
+    unsigned timelineTracks;
+
+    /// When the CPU side started rejecting requests
+    Tick rejectStartTick;
+
+    /// Wakes up a requestor rejected because of the crypto queue
+    EventFunctionWrapper cryptoRetryEvent;
+
+    /// Whether the host time of requests and responses is measured
+    const bool hostProfile;
+
+    struct SecCtrlStats : public statistics::Group
+    {
+        SecCtrlStats(SecCtrl &ctrl);
+
+        void regStats() override;
+
+        const SecCtrl &ctrl;
+
+        statistics::Scalar readReqs;
+        statistics::Scalar writeReqs;
+
+        statistics::Histogram readLatency;
+        statistics::Histogram writeLatency;
+
+        statistics::Scalar counterHits;
+        statistics::Scalar counterMisses;
+        statistics::Formula counterHitRate;
+        statistics::Scalar macHits;
+        statistics::Scalar macMisses;
+        statistics::Formula macHitRate;
+        statistics::Vector mtHits;
+        statistics::Vector mtMisses;
+        statistics::Formula mtHitRate;
+
+        statistics::Scalar metaMisses;
+        statistics::Scalar conflictMisses;
+        statistics::Formula conflictMissRatio;
+
+        statistics::Distribution mtWalkDepth;
+        statistics::Scalar pinnedAccesses;
+        statistics::Scalar aheadTreeFetches;
+        statistics::Scalar wastedTreeFetches;
+        statistics::Formula wastedFetchRatio;
+
+        statistics::Scalar rejectedReqs;
+        statistics::Scalar rejectedCycles;
+
+        statistics::Scalar metaBytesRead;
+        statistics::Scalar metaBytesWritten;
+
+        statistics::Scalar counterOverflows;
+        statistics::Scalar counterReencodings;
+        statistics::Scalar reencryptedBlocks;
+
+        statistics::Scalar evictionUpdates;
+
+        statistics::Scalar padStalls;
+
+        statistics::Scalar speculativeReads;
+        statistics::Scalar speculationStalls;
+        statistics::Histogram verificationLag;
+
+        statistics::Scalar bufferedWrites;
+        statistics::Scalar mergedWrites;
+        statistics::Scalar forwardedReads;
+        statistics::Scalar writeBufferFull;
+        statistics::Average writeBufferOccupancy;
+
+        statistics::Scalar scheduledEvents;
+        statistics::Formula eventsPerRequest;
+        statistics::Scalar hostRequestTime;
+        statistics::Scalar hostResponseTime;
+        statistics::Scalar hostResponses;
+        statistics::Formula hostTimePerRequest;
+        statistics::Formula hostTimePerResponse;
+    };
+
+    SecCtrlStats stats;
 
   public:
 
@@ -260,6 +978,7 @@ class SecCtrl : public SimObject
      * Constructor
      */
     SecCtrl(const SecCtrlParams &p);
+    ~SecCtrl();
 
     /**
      * Get a port with a given name and index. This is used at
@@ -273,6 +992,19 @@ class SecCtrl : public SimObject
      */
     Port &getPort(const std::string &if_name,
                   PortID idx=InvalidPortID) override;
+
+    /**
+     * Stop accepting requests and let the in-flight ones finish.
+     */
+    DrainState drain() override;
+    void drainResume() override;
+
+    /**
+     * Checkpoint the counter values, the only state that survives a
+     * drain.
+     */
+    void serialize(CheckpointOut &cp) const override;
+    void unserialize(CheckpointIn &cp) override;
 };
 
 } // namespace gem5
@@ -0,0 +1,204 @@
+#include "csh/sec_layout.hh"
+
+#include <algorithm>
+
+namespace gem5
+{
+
+static bool
+isPowerOf2(uint64_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static uint64_t
+divCeil(uint64_t a, uint64_t b)
+{
+    return (a + b - 1) / b;
+}
+
+unsigned
+SecLayout::defaultCounterSize(CounterMode mode)
+{
+    return mode == Split ? 7 : 8;
+}
+
+SecLayout::Params
+SecLayout::withDefaults(const Params &p)
+{
+    Params params = p;
+    if (params.counterSize == 0) {
+        params.counterSize = defaultCounterSize(params.counterMode);
+    }
+
+    return params;
+}
+
+SecLayout::SecLayout(const Params &p) :
+    params(withDefaults(p)),
+    _cntsPerBlock(0),
+    _cntBorder(0), _macBorder(0),
+    _pinnedLevel(0)
+{
+    if (p.dataSize == 0 || p.dataSize % NODE_SPACE != 0) {
+        _error = "data_size must be a multiple of " +
+            std::to_string(NODE_SPACE) + " bytes";
+        return;
+    }
+    if (p.counterMode == Split) {
+        // A 64 bit major counter and one minor counter per data block
+        _cntsPerBlock = 64;
+        if (_cntsPerBlock * params.counterSize + 64 > NODE_SPACE * 8) {
+            _error = std::to_string(_cntsPerBlock) + " minor counters of " +
+                std::to_string(params.counterSize) + " bits do not fit a " +
+                "counter block";
+            return;
+        }
+    } else if (p.counterMode == Morphable) {
+        _cntsPerBlock = morphCounters;
+    } else {
+        if (params.counterSize > NODE_SPACE * 8 ||
+            !isPowerOf2(params.counterSize)) {
+            _error = "counter_size must be a power of 2 up to " +
+                std::to_string(NODE_SPACE * 8) + " bits";
+            return;
+        }
+        _cntsPerBlock = NODE_SPACE * 8 / params.counterSize;
+    }
+    if (p.macSize == 0 || p.macSize > NODE_SPACE) {
+        _error = "mac_size must be between 1 and " +
+            std::to_string(NODE_SPACE) + " bytes";
+        return;
+    }
+    if (p.treeArity < 2 || p.treeArity > morphCounters ||
+        !isPowerOf2(p.treeArity)) {
+        _error = "tree_arity must be a power of 2 between 2 and " +
+            std::to_string(morphCounters);
+        return;
+    }
+
+    // Calculate each space border
+    _cntBorder = p.dataSize;
+
+    Addr cnt_space =
+        divCeil(p.dataSize / NODE_SPACE, _cntsPerBlock) * NODE_SPACE;
+
+    _macBorder = _cntBorder + cnt_space;
+
+    // Every level hashes arity nodes of the level below into one node
+    // until a single node, the root, is left
+    Addr nodes = cnt_space / NODE_SPACE;
+    Addr border = _macBorder;
+    if (!p.macInline) border += p.dataSize / NODE_SPACE * p.macSize;
+    while (true) {
+        nodes = divCeil(nodes, p.treeArity);
+        _mtBorders.push_back(border);
+
+        if (nodes == 1 && _mtBorders.size() >= 2) break;
+
+        border += nodes * NODE_SPACE;
+    }
+
+    if (p.treeLevels != 0 && p.treeLevels < _mtBorders.size()) {
+        _error = "tree_levels must be at least " +
+            std::to_string(_mtBorders.size()) + " to cover " +
+            std::to_string(p.dataSize) + " bytes";
+        return;
+    }
+
+    // Extra levels on top of the required ones have a single node
+    while (_mtBorders.size() < p.treeLevels) {
+        _mtBorders.push_back(_mtBorders.back() + NODE_SPACE);
+    }
+
+    if (p.pinnedLevels > mtLevel()-1u) {
+        _error = "pinned_levels must be at most the " +
+            std::to_string(mtLevel()-1) + " stored tree levels";
+        return;
+    }
+    _pinnedLevel = mtLevel()-1 - p.pinnedLevels;
+}
+
+Addr
+SecLayout::counterOffset(Addr pktAddr) const
+{
+    Addr blk = pktAddr / NODE_SPACE;
+
+    return blk / _cntsPerBlock * NODE_SPACE +
+        blk % _cntsPerBlock * NODE_SPACE / _cntsPerBlock;
+}
+
+Addr
+SecLayout::cntAddr(Addr cntOffs) const
+{
+    // The minor counter is useless without the major one, so the whole
+    // counter block is accessed
+    if (params.counterMode != Monolithic) {
+        return _cntBorder + cntOffs / NODE_SPACE * NODE_SPACE;
+    }
+
+    return _cntBorder + cntOffs;
+}
+
+unsigned
+SecLayout::cntSize() const
+{
+    if (params.counterMode != Monolithic) return NODE_SPACE;
+
+    return divCeil(params.counterSize, 8);
+}
+
+Addr
+SecLayout::macAddr(Addr pktAddr) const
+{
+    return _macBorder + pktAddr / NODE_SPACE * params.macSize;
+}
+
+Addr
+SecLayout::mtAddr(Addr cntOffs, uint8_t nth, bool isRead) const
+{
+    // Index of the child node below the nth level
+    Addr child = cntOffs / NODE_SPACE;
+    for (uint8_t i=0; i<nth; i++) child /= params.treeArity;
+
+    // A node is read as a whole, but only the child's hash (or counter
+    // in a compact counter tree) is written
+    Addr addr = _mtBorders[nth] + child / params.treeArity * NODE_SPACE;
+    if (!isRead) {
+        addr += child % params.treeArity * NODE_SPACE / params.treeArity;
+    }
+
+    return addr;
+}
+
+unsigned
+SecLayout::mtSize(bool isRead) const
+{
+    return isRead ? NODE_SPACE :
+        std::max(NODE_SPACE / params.treeArity, 1U);
+}
+
+bool
+SecLayout::parentNode(Addr addr, Addr &parent, uint8_t &level) const
+{
+    Addr child;
+    if (addr >= _cntBorder && addr < _macBorder) {
+        child = (addr - _cntBorder) / NODE_SPACE;
+        level = 0;
+    } else if (addr >= _mtBorders[0] && addr < _mtBorders[mtLevel()-1]) {
+        level = 1;
+        while (addr >= _mtBorders[level]) level++;
+        child = (addr - _mtBorders[level-1]) / NODE_SPACE;
+    } else {
+        // Data and MACs
+        return false;
+    }
+
+    // Same slot mtAddr writes on the way up
+    parent = _mtBorders[level] + child / params.treeArity * NODE_SPACE +
+        child % params.treeArity * NODE_SPACE / params.treeArity;
+
+    return true;
+}
+
+} // namespace gem5
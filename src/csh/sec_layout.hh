@@ -0,0 +1,137 @@
+#ifndef __CSH_SEC_LAYOUT_HH__
+#define __CSH_SEC_LAYOUT_HH__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Size of a counter block and of a Merkle Tree node
+#define NODE_SPACE 0x40
+
+namespace gem5
+{
+
+// Same as in base/types.hh, which is not included to stay usable
+// outside of gem5
+typedef uint64_t Addr;
+
+/**
+ * Placement of the security metadata behind the protected data:
+ * counters, MACs and the stored Merkle Tree levels, the last level being
+ * the on-chip root. It does not depend on gem5, so that the standalone
+ * replay tool lays memory out the same way as SecCtrl.
+ */
+class SecLayout
+{
+  public:
+
+    enum CounterMode
+    {
+        Monolithic,
+        Split,
+        Morphable
+    };
+
+    /// Minor counters of a morphable counter block
+    static const unsigned morphCounters = 128;
+
+    struct Params
+    {
+        Addr dataSize;
+        CounterMode counterMode;
+        /// Bits per counter, per minor counter if split, 0 for the
+        /// default of the counter mode
+        unsigned counterSize;
+        /// Bytes of MAC per data block
+        unsigned macSize;
+        /// MACs in the ECC bits of their data instead of a region
+        bool macInline;
+        unsigned treeArity;
+        /// Tree levels including the root, 0 for the minimum
+        unsigned treeLevels;
+        /// Top stored tree levels kept on chip
+        unsigned pinnedLevels;
+    };
+
+  private:
+    const Params params;
+
+    /// Why the parameters do not give a layout, empty if they do
+    std::string _error;
+
+    unsigned _cntsPerBlock;
+
+    Addr _cntBorder;
+    Addr _macBorder;
+    std::vector<Addr> _mtBorders;
+
+    uint8_t _pinnedLevel;
+
+    /// The parameters with the counter size of the mode filled in
+    static Params withDefaults(const Params &p);
+
+  public:
+
+    SecLayout(const Params &p);
+
+    const std::string &error() const { return _error; }
+
+    /**
+     * Counter size of a mode when none is given: 7 bit minors fill a
+     * split counter block with its 64 bit major, 8 bits otherwise.
+     */
+    static unsigned defaultCounterSize(CounterMode mode);
+
+    CounterMode counterMode() const { return params.counterMode; }
+
+    /// Bits per counter, per minor counter if split
+    unsigned counterSize() const { return params.counterSize; }
+
+    unsigned macSize() const { return params.macSize; }
+    bool macInline() const { return params.macInline; }
+
+    /// Data blocks covered by a counter block
+    unsigned cntsPerBlock() const { return _cntsPerBlock; }
+
+    Addr cntBorder() const { return _cntBorder; }
+    Addr macBorder() const { return _macBorder; }
+
+    /**
+     * Start of every stored tree level, and the end of the protected
+     * memory as the border of the root.
+     */
+    const std::vector<Addr> &mtBorders() const { return _mtBorders; }
+
+    /// Tree levels above the counters, the last one is the on-chip root
+    uint8_t mtLevel() const { return _mtBorders.size(); }
+
+    /**
+     * First of the stored levels pinned on chip, or the root. Every
+     * walk ends below it.
+     */
+    uint8_t pinnedLevel() const { return _pinnedLevel; }
+
+    /**
+     * Metadata address mapping of a data block
+     */
+    Addr counterOffset(Addr pktAddr) const;
+    Addr cntAddr(Addr cntOffs) const;
+    unsigned cntSize() const;
+    Addr macAddr(Addr pktAddr) const;
+    Addr mtAddr(Addr cntOffs, uint8_t nth, bool isRead) const;
+    unsigned mtSize(bool isRead) const;
+
+    /**
+     * Find the tree node holding the hash of a counter block or node.
+     *
+     * @param addr address of the counter block or node
+     * @param level set to the level of the parent, mtLevel-1 for the
+     *        on-chip root
+     * @return false if the block is not covered by the tree
+     */
+    bool parentNode(Addr addr, Addr &parent, uint8_t &level) const;
+};
+
+} // namespace gem5
+
+#endif // __CSH_SEC_LAYOUT_HH__
@@ -0,0 +1,64 @@
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include <string>
+
+#include "csh/sec_layout.hh"
+#include "sim/init.hh"
+
+namespace py = pybind11;
+
+namespace gem5
+{
+
+namespace
+{
+
+/**
+ * The metadata borders of the SecCtrl parameters, so that the configs
+ * size the memory behind a controller the way it lays the metadata out.
+ *
+ * @return the reason the parameters give no layout, empty if they do,
+ *         the counter border, the MAC border and the tree borders
+ */
+py::tuple
+layoutBorders(Addr dataSize, const std::string &counterMode,
+              unsigned counterSize, unsigned macSize, bool macInline,
+              unsigned treeArity, unsigned treeLevels,
+              unsigned pinnedLevels)
+{
+    SecLayout::Params params;
+    params.dataSize = dataSize;
+    if (counterMode == "split") {
+        params.counterMode = SecLayout::Split;
+    } else if (counterMode == "morphable") {
+        params.counterMode = SecLayout::Morphable;
+    } else {
+        params.counterMode = SecLayout::Monolithic;
+    }
+    params.counterSize = counterSize;
+    params.macSize = macSize;
+    params.macInline = macInline;
+    params.treeArity = treeArity;
+    params.treeLevels = treeLevels;
+    params.pinnedLevels = pinnedLevels;
+
+    SecLayout layout(params);
+
+    return py::make_tuple(layout.error(), layout.cntBorder(),
+                          layout.macBorder(), layout.mtBorders());
+}
+
+void
+pybind_init_sec_layout(py::module_ &m_native)
+{
+    py::module_ m = m_native.def_submodule("sec_layout");
+
+    m.def("borders", &layoutBorders);
+}
+
+EmbeddedPyBind embed_sec_layout("sec_layout", &pybind_init_sec_layout);
+
+} // anonymous namespace
+
+} // namespace gem5
@@ -0,0 +1,121 @@
+#include "csh/sec_walk.hh"
+
+#include <algorithm>
+
+namespace gem5
+{
+
+SecWalk::SecWalk(const SecLayout &_layout, SecCounters &_counters,
+                 const Params &p) :
+    layout(_layout), counters(_counters), params(p)
+{
+}
+
+Addr
+SecWalk::reencrypt(Addr cntBlk, const AccessFunc &access) const
+{
+    Addr first_blk = cntBlk * layout.cntsPerBlock();
+    Addr last_blk = std::min<Addr>(first_blk + layout.cntsPerBlock(),
+                                   layout.cntBorder() / NODE_SPACE);
+    bool hit;
+
+    for (Addr blk = first_blk; blk < last_blk; blk++) {
+        for (bool is_read : { true, false }) {
+            access({blk * NODE_SPACE, NODE_SPACE, is_read, ReencData, 0},
+                   hit);
+        }
+
+        if (!layout.macInline()) {
+            access({layout.macAddr(blk * NODE_SPACE), layout.macSize(),
+                    false, ReencMac, 0}, hit);
+        }
+    }
+
+    return last_blk - first_blk;
+}
+
+SecWalk::Result
+SecWalk::walk(Addr pktAddr, bool isRead, uint64_t dataLatency,
+              const AccessFunc &access)
+{
+    Result result = { 0, 0, false, SecCounters::Incremented, 0 };
+    Addr cnt_offs = layout.counterOffset(pktAddr);
+    bool hit;
+
+    uint64_t data_lat = dataLatency;
+    uint64_t cnt_lat = access({layout.cntAddr(cnt_offs), layout.cntSize(),
+                               true, Counter, 0}, hit);
+    uint64_t meta_lat = cnt_lat;
+
+    if (isRead) {
+        if (layout.macInline()) {
+            data_lat += params.macBurstLatency;
+        } else {
+            meta_lat = std::max(meta_lat,
+                    access({layout.macAddr(pktAddr), layout.macSize(),
+                            true, Mac, 0}, hit));
+        }
+
+        // A cached node is trusted, so the walk stops there
+        hit = false;
+        while (!hit && result.levels < layout.pinnedLevel()) {
+            access({layout.mtAddr(cnt_offs, result.levels, true),
+                    layout.mtSize(true), true, Tree, result.levels}, hit);
+            result.levels++;
+        }
+        result.pinnedAccess = !hit;
+
+    } else {
+        result.counterUpdate = counters.increment(pktAddr);
+        if (result.counterUpdate == SecCounters::Overflowed) {
+            result.reencryptedBlocks = reencrypt(
+                    pktAddr / NODE_SPACE / layout.cntsPerBlock(), access);
+        }
+        access({layout.cntAddr(cnt_offs), layout.cntSize(), false,
+                CounterUpdate, 0}, hit);
+
+        if (layout.macInline()) {
+            data_lat += params.macBurstLatency;
+        } else {
+            access({layout.macAddr(pktAddr), layout.macSize(), false, Mac,
+                    0}, hit);
+        }
+
+        // Update the hashes root-ward until a cached node, reading the
+        // siblings of every node missing in the cache. Lazily, the
+        // evictions of the metadata cache do it instead.
+        if (!params.lazyTreeUpdates) {
+            hit = false;
+            while (!hit && result.levels < layout.pinnedLevel()) {
+                access({layout.mtAddr(cnt_offs, result.levels, false),
+                        layout.mtSize(false), false, Tree, result.levels},
+                       hit);
+                if (!hit) {
+                    access({layout.mtAddr(cnt_offs, result.levels, true),
+                            layout.mtSize(true), true, Tree,
+                            result.levels}, hit);
+                    hit = false;
+                }
+                result.levels++;
+            }
+            result.pinnedAccess = !hit;
+        }
+    }
+
+    uint64_t pinned_lat = 0;
+    if (result.pinnedAccess && result.levels < layout.mtLevel()-1) {
+        pinned_lat = params.pinnedLatency;
+    }
+
+    // Without contention the pad is generated while the data is fetched,
+    // and the MAC is computed once data and counter are here
+    result.latency = std::max({
+            cnt_lat + params.aesLatency,
+            std::max(data_lat, cnt_lat) + params.macLatency,
+            meta_lat + params.hashLatency * result.levels + pinned_lat}) +
+        params.compareLatency;
+
+    return result;
+}
+
+} // namespace gem5
@@ -0,0 +1,112 @@
+#ifndef __CSH_SEC_WALK_HH__
+#define __CSH_SEC_WALK_HH__
+
+#include <cstdint>
+#include <functional>
+
+#include "csh/sec_counters.hh"
+#include "csh/sec_layout.hh"
+
+namespace gem5
+{
+
+/**
+ * The metadata accesses of a data access the way SecCtrl makes them in
+ * atomic mode, and the latency they add without contention. It does not
+ * depend on gem5, so that the standalone replay tool walks the metadata
+ * the same way as SecCtrl.
+ */
+class SecWalk
+{
+  public:
+
+    /// What an access of the walk is for
+    enum Type
+    {
+        Counter,
+        CounterUpdate,
+        Mac,
+        Tree,
+        /// Data block read and written back to re-encrypt it
+        ReencData,
+        ReencMac
+    };
+
+    struct Access
+    {
+        Addr addr;
+        unsigned size;
+        bool isRead;
+        Type type;
+        /// Tree level of a tree access
+        uint8_t level;
+    };
+
+    /**
+     * Make an access of the walk.
+     *
+     * @param hit set to whether the metadata was cached
+     * @return the latency of the access
+     */
+    typedef std::function<uint64_t(const Access &access, bool &hit)>
+        AccessFunc;
+
+    /**
+     * Latencies in the unit of the caller
+     */
+    struct Params
+    {
+        /// Writes leave the tree to the evictions of the metadata cache
+        bool lazyTreeUpdates;
+        uint64_t aesLatency;
+        uint64_t macLatency;
+        uint64_t hashLatency;
+        uint64_t compareLatency;
+        /// Extra bursts of a data block carrying its MAC
+        uint64_t macBurstLatency;
+        /// Access to a pinned tree level, the root register is free
+        uint64_t pinnedLatency;
+    };
+
+    struct Result
+    {
+        uint64_t latency;
+        /// Stored tree levels accessed until a cached node
+        uint8_t levels;
+        /// Whether the walk went on to the on-chip levels
+        bool pinnedAccess;
+        /// What a write did to its counter
+        SecCounters::Update counterUpdate;
+        /// Data blocks re-encrypted on a counter overflow
+        Addr reencryptedBlocks;
+    };
+
+  private:
+    const SecLayout &layout;
+    SecCounters &counters;
+    const Params params;
+
+    /**
+     * Read and write back every data block covered by a counter block,
+     * together with its MAC.
+     */
+    Addr reencrypt(Addr cntBlk, const AccessFunc &access) const;
+
+  public:
+
+    SecWalk(const SecLayout &layout, SecCounters &counters,
+            const Params &p);
+
+    /**
+     * Walk the metadata of a data access. The counter of a write is
+     * incremented, re-encrypting its counter block on an overflow.
+     *
+     * @param dataLatency latency of the data access itself
+     */
+    Result walk(Addr pktAddr, bool isRead, uint64_t dataLatency,
+                const AccessFunc &access);
+};
+
+} // namespace gem5
+
+#endif // __CSH_SEC_WALK_HH__
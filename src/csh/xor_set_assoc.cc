@@ -0,0 +1,44 @@
+#include "csh/xor_set_assoc.hh"
+
+#include "base/intmath.hh"
+#include "params/XorSetAssociative.hh"
+
+namespace gem5
+{
+
+XorSetAssociative::XorSetAssociative(const Params &p) :
+    SetAssociative(p)
+{
+}
+
+uint32_t
+XorSetAssociative::foldTag(Addr tag) const
+{
+    // A single set has no index bits to fold into
+    if (setMask == 0) return 0;
+
+    uint32_t folded = 0;
+    while (tag != 0) {
+        folded ^= tag & setMask;
+        tag >>= floorLog2(numSets);
+    }
+
+    return folded;
+}
+
+uint32_t
+XorSetAssociative::extractSet(const Addr addr) const
+{
+    return ((addr >> setShift) ^ foldTag(extractTag(addr))) & setMask;
+}
+
+Addr
+XorSetAssociative::regenerateAddr(const Addr tag,
+                                  const ReplaceableEntry *entry) const
+{
+    Addr set = (entry->getSet() ^ foldTag(tag)) & setMask;
+
+    return (tag << tagShift) | (set << setShift);
+}
+
+} // namespace gem5
@@ -0,0 +1,52 @@
+#ifndef __CSH_XOR_SET_ASSOC_HH__
+#define __CSH_XOR_SET_ASSOC_HH__
+
+#include "mem/cache/tags/indexing_policies/set_associative.hh"
+
+namespace gem5
+{
+
+struct XorSetAssociativeParams;
+
+/**
+ * Set associative indexing where the tag is XOR-folded into the set
+ * index. Metadata blocks at power of two aligned regions, like the
+ * counter, MAC and tree nodes of one page, otherwise pile up in the
+ * same sets.
+ */
+class XorSetAssociative : public SetAssociative
+{
+  private:
+    /**
+     * XOR all set index wide slices of a tag together.
+     */
+    uint32_t foldTag(Addr tag) const;
+
+  protected:
+    /**
+     * Apply the folded tag to the set bits of the address.
+     *
+     * @param addr Address to be hashed.
+     * @return The set index of the address.
+     */
+    uint32_t extractSet(const Addr addr) const override;
+
+  public:
+    typedef XorSetAssociativeParams Params;
+
+    XorSetAssociative(const Params &p);
+
+    /**
+     * Undo the folding to get the address of a block back.
+     *
+     * @param tag The tag bits.
+     * @param entry The entry.
+     * @return the entry's original addr value.
+     */
+    Addr regenerateAddr(const Addr tag,
+                        const ReplaceableEntry *entry) const override;
+};
+
+} // namespace gem5
+
+#endif // __CSH_XOR_SET_ASSOC_HH__
@@ -0,0 +1,684 @@
+/**
+ * Replay a memory access trace through the metadata layout of SecCtrl,
+ * a set associative metadata cache and a fixed latency memory, without
+ * gem5. Every access is run through all configurations at once, so a
+ * whole sweep takes a single pass over the trace.
+ *
+ * The trace is text, one access per line as "<op> <addr>" or
+ * "<tick> <op> <addr>", where an op starting with r or w is a read or a
+ * write and the address is decimal or 0x prefixed hex. Empty lines and
+ * lines starting with # are skipped.
+ *
+ * A configuration is a comma separated list of key=value pairs, and a
+ * value may list alternatives separated by / to sweep all their
+ * combinations, e.g. "arity=4/8,cache=64kB/128kB". The metadata is
+ * walked by SecWalk, like SecCtrl does in atomic mode.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "csh/sec_counters.hh"
+#include "csh/sec_layout.hh"
+#include "csh/sec_walk.hh"
+
+using gem5::Addr;
+using gem5::SecCounters;
+using gem5::SecLayout;
+using gem5::SecWalk;
+
+namespace
+{
+
+struct Access
+{
+    Addr addr;
+    bool isWrite;
+};
+
+/**
+ * Everything one configuration of the sweep sets. Latencies are in ns,
+ * with the defaults of SecCtrl, CryptoEngine and MetaCache at 1 GHz.
+ */
+struct ReplayConfig
+{
+    std::string name;
+
+    SecLayout::Params layout = {
+        Addr(8) << 30, SecLayout::Monolithic, 0, 16, false, 8, 0, 0 };
+    SecCounters::Encoding counterEncoding = SecCounters::Adaptive;
+    bool lazyTreeUpdates = false;
+
+    uint64_t cacheSize = 128 << 10;
+    unsigned cacheAssoc = 4;
+    bool xorIndexing = false;
+
+    uint64_t cacheLatency = 4;
+    uint64_t memLatency = 150;
+    uint64_t aesLatency = 40;
+    uint64_t hashLatency = 80;
+    uint64_t macLatency = 80;
+    uint64_t compareLatency = 1;
+    uint64_t pinnedLatency = 2;
+    uint64_t macBurstLatency = 4;
+};
+
+bool
+parseUnsigned(const std::string &str, uint64_t &value)
+{
+    char *end;
+    value = strtoull(str.c_str(), &end, 0);
+    if (end == str.c_str()) return false;
+
+    // Binary size suffixes as in gem5 configs
+    std::string suffix(end);
+    if (suffix.empty() || suffix == "B") return true;
+
+    static const std::map<std::string, int> shifts = {
+        { "k", 10 }, { "kB", 10 }, { "KiB", 10 },
+        { "M", 20 }, { "MB", 20 }, { "MiB", 20 },
+        { "G", 30 }, { "GB", 30 }, { "GiB", 30 },
+    };
+    auto it = shifts.find(suffix);
+    if (it == shifts.end()) return false;
+
+    value <<= it->second;
+    return true;
+}
+
+/**
+ * Setters of the configuration keys, false on a bad value.
+ */
+typedef std::function<bool(ReplayConfig &, const std::string &)> Setter;
+
+Setter
+unsignedSetter(std::function<void(ReplayConfig &, uint64_t)> set)
+{
+    return [set](ReplayConfig &config, const std::string &str) {
+        uint64_t value;
+        if (!parseUnsigned(str, value)) return false;
+        set(config, value);
+        return true;
+    };
+}
+
+const std::map<std::string, Setter> &
+configKeys()
+{
+    static const std::map<std::string, Setter> keys = {
+        { "data", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.dataSize = v; }) },
+        { "counter", [](ReplayConfig &c, const std::string &v) {
+            if (v == "monolithic") {
+                c.layout.counterMode = SecLayout::Monolithic;
+            } else if (v == "split") {
+                c.layout.counterMode = SecLayout::Split;
+            } else if (v == "morphable") {
+                c.layout.counterMode = SecLayout::Morphable;
+            } else {
+                return false;
+            }
+            return true; } },
+        { "counter_size", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.counterSize = v; }) },
+        { "encoding", [](ReplayConfig &c, const std::string &v) {
+            if (v == "uniform") {
+                c.counterEncoding = SecCounters::Uniform;
+            } else if (v == "zcc") {
+                c.counterEncoding = SecCounters::Zcc;
+            } else if (v == "adaptive") {
+                c.counterEncoding = SecCounters::Adaptive;
+            } else {
+                return false;
+            }
+            return true; } },
+        { "mac_size", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.macSize = v; }) },
+        { "mac_inline", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.macInline = v != 0; }) },
+        { "arity", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.treeArity = v; }) },
+        { "levels", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.treeLevels = v; }) },
+        { "pinned", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.layout.pinnedLevels = v; }) },
+        { "lazy", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.lazyTreeUpdates = v != 0; }) },
+        { "cache", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.cacheSize = v; }) },
+        { "assoc", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.cacheAssoc = v; }) },
+        { "indexing", [](ReplayConfig &c, const std::string &v) {
+            if (v != "modulo" && v != "xor") return false;
+            c.xorIndexing = v == "xor";
+            return true; } },
+        { "cache_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.cacheLatency = v; }) },
+        { "mem_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.memLatency = v; }) },
+        { "aes_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.aesLatency = v; }) },
+        { "hash_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.hashLatency = v; }) },
+        { "mac_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.macLatency = v; }) },
+        { "pinned_lat", unsignedSetter([](ReplayConfig &c, uint64_t v) {
+            c.pinnedLatency = v; }) },
+    };
+
+    return keys;
+}
+
+std::vector<std::string>
+split(const std::string &str, char sep)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true) {
+        size_t end = str.find(sep, start);
+        parts.push_back(str.substr(start, end - start));
+        if (end == std::string::npos) return parts;
+        start = end + 1;
+    }
+}
+
+/**
+ * Expand a configuration string into all the combinations of its
+ * alternatives.
+ */
+bool
+expandConfig(const std::string &str, std::vector<ReplayConfig> &configs)
+{
+    std::vector<ReplayConfig> expanded(1);
+
+    for (const auto &pair : split(str, ',')) {
+        if (pair.empty()) continue;
+
+        size_t eq = pair.find('=');
+        auto key = configKeys().find(pair.substr(0, eq));
+        if (eq == std::string::npos || key == configKeys().end()) {
+            fprintf(stderr, "Unknown configuration key in '%s'\n",
+                    pair.c_str());
+            return false;
+        }
+
+        std::vector<ReplayConfig> next;
+        for (const auto &value : split(pair.substr(eq + 1), '/')) {
+            for (ReplayConfig config : expanded) {
+                if (!key->second(config, value)) {
+                    fprintf(stderr, "Bad value '%s' of %s\n",
+                            value.c_str(), key->first.c_str());
+                    return false;
+                }
+                if (!config.name.empty()) config.name += ",";
+                config.name += key->first + "=" + value;
+                next.push_back(config);
+            }
+        }
+        expanded.swap(next);
+    }
+
+    for (auto &config : expanded) {
+        if (config.name.empty()) config.name = "default";
+        configs.push_back(config);
+    }
+
+    return true;
+}
+
+/**
+ * Write back, write allocate cache of NODE_SPACE byte blocks with LRU
+ * replacement, indexed like SetAssociative or XorSetAssociative.
+ */
+class MetaCacheModel
+{
+  private:
+    struct Line
+    {
+        Addr blk;
+        uint64_t lastUse;
+        bool valid;
+        bool dirty;
+    };
+
+    const unsigned assoc;
+    const bool xorIndexing;
+    unsigned numSets;
+    unsigned setBits;
+    std::vector<Line> lines;
+    uint64_t useCount;
+
+    unsigned
+    extractSet(Addr blk) const
+    {
+        Addr mask = numSets - 1;
+        if (!xorIndexing || mask == 0) return blk & mask;
+
+        // XOR all set index wide slices of the tag into the index
+        Addr folded = 0;
+        for (Addr tag = blk >> setBits; tag != 0; tag >>= setBits) {
+            folded ^= tag & mask;
+        }
+
+        return (blk ^ folded) & mask;
+    }
+
+  public:
+    MetaCacheModel(uint64_t size, unsigned _assoc, bool _xorIndexing) :
+        assoc(_assoc), xorIndexing(_xorIndexing),
+        numSets(_assoc != 0 ? size / NODE_SPACE / _assoc : 0), setBits(0),
+        useCount(0)
+    {
+        // valid() reports a geometry without sets
+        if (!valid()) return;
+
+        while ((1u << setBits) < numSets) setBits++;
+        lines.resize(numSets * assoc, Line{0, 0, false, false});
+    }
+
+    bool
+    valid() const
+    {
+        return assoc != 0 && numSets != 0 && (numSets & (numSets-1)) == 0;
+    }
+
+    /**
+     * Access a block, allocating it on a miss.
+     *
+     * @param victim set to the evicted block if it was dirty
+     * @return whether the block hit
+     */
+    bool
+    access(Addr blk, bool isWrite, bool &evictedDirty, Addr &victim)
+    {
+        Line *set = &lines[extractSet(blk) * assoc];
+        Line *lru = set;
+        useCount++;
+        evictedDirty = false;
+
+        for (unsigned way=0; way<assoc; way++) {
+            if (set[way].valid && set[way].blk == blk) {
+                set[way].lastUse = useCount;
+                set[way].dirty |= isWrite;
+                return true;
+            }
+            if (!set[way].valid) {
+                lru = &set[way];
+            } else if (lru->valid && set[way].lastUse < lru->lastUse) {
+                lru = &set[way];
+            }
+        }
+
+        evictedDirty = lru->valid && lru->dirty;
+        victim = lru->blk;
+        *lru = Line{blk, useCount, true, isWrite};
+
+        return false;
+    }
+};
+
+/**
+ * One configuration replaying the trace, counting what SecCtrl counts.
+ */
+class Replayer
+{
+  private:
+    const ReplayConfig config;
+    const SecLayout layout;
+    SecCounters counters;
+    SecWalk walker;
+    MetaCacheModel cache;
+
+    /// Parents of evicted blocks waiting to be rehashed
+    std::vector<std::pair<Addr, uint8_t>> treeUpdates;
+
+  public:
+    struct Stats
+    {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t counterHits = 0;
+        uint64_t counterMisses = 0;
+        uint64_t macHits = 0;
+        uint64_t macMisses = 0;
+        uint64_t mtHits = 0;
+        uint64_t mtMisses = 0;
+        uint64_t walkLevels = 0;
+        uint64_t pinnedAccesses = 0;
+        uint64_t counterOverflows = 0;
+        uint64_t reencryptedBlocks = 0;
+        uint64_t evictionUpdates = 0;
+        uint64_t metaBlocksRead = 0;
+        uint64_t metaBlocksWritten = 0;
+        uint64_t readLatency = 0;
+        uint64_t writeLatency = 0;
+    };
+
+    Stats stats;
+
+  private:
+    /**
+     * Access a block of metadata through the cache.
+     *
+     * @return the latency of the access
+     */
+    uint64_t
+    metaAccess(Addr addr, bool isWrite, bool &hit)
+    {
+        bool evicted_dirty;
+        Addr victim;
+        hit = cache.access(addr / NODE_SPACE, isWrite, evicted_dirty,
+                           victim);
+
+        if (!hit) stats.metaBlocksRead++;
+
+        if (evicted_dirty) {
+            stats.metaBlocksWritten++;
+
+            // Rehash the parent of the written back block
+            Addr parent;
+            uint8_t level;
+            if (config.lazyTreeUpdates &&
+                layout.parentNode(victim * NODE_SPACE, parent, level)) {
+                stats.evictionUpdates++;
+                if (level < layout.pinnedLevel()) {
+                    treeUpdates.emplace_back(parent, level);
+                }
+            }
+        }
+
+        return hit ? config.cacheLatency :
+            config.cacheLatency + config.memLatency;
+    }
+
+    /**
+     * Make an access of the metadata walk, the data of a re-encryption
+     * going straight to memory.
+     */
+    uint64_t
+    walkAccess(const SecWalk::Access &access, bool &hit)
+    {
+        if (access.type == SecWalk::ReencData) {
+            hit = false;
+            return config.memLatency;
+        }
+
+        uint64_t latency = metaAccess(access.addr, !access.isRead, hit);
+
+        switch (access.type) {
+            case SecWalk::Counter:
+            case SecWalk::CounterUpdate:
+                if (hit) stats.counterHits++; else stats.counterMisses++;
+                break;
+            case SecWalk::Mac:
+                if (hit) stats.macHits++; else stats.macMisses++;
+                break;
+            case SecWalk::Tree:
+                if (hit) stats.mtHits++; else stats.mtMisses++;
+                break;
+            default:
+                // Re-encryption traffic
+                break;
+        }
+
+        return latency;
+    }
+
+  public:
+    Replayer(const ReplayConfig &_config) :
+        config(_config), layout(_config.layout),
+        counters(layout, _config.counterEncoding),
+        walker(layout, counters, {
+            _config.lazyTreeUpdates,
+            _config.aesLatency,
+            _config.macLatency,
+            _config.hashLatency,
+            _config.compareLatency,
+            _config.macBurstLatency,
+            _config.pinnedLatency}),
+        cache(_config.cacheSize, _config.cacheAssoc, _config.xorIndexing)
+    {}
+
+    const ReplayConfig &getConfig() const { return config; }
+
+    /**
+     * Why the configuration cannot be replayed, empty if it can.
+     */
+    std::string
+    error() const
+    {
+        if (!layout.error().empty()) return layout.error();
+        if (!cache.valid()) {
+            return "the cache must have a power of 2 number of sets";
+        }
+        return "";
+    }
+
+    Addr dataSize() const { return layout.cntBorder(); }
+
+    /**
+     * Replay an access the way SecCtrl::handleAtomic does.
+     */
+    void
+    access(Addr pkt_addr, bool is_read)
+    {
+        if (is_read) stats.reads++; else stats.writes++;
+
+        SecWalk::Result result = walker.walk(pkt_addr, is_read,
+            config.memLatency,
+            [this](const SecWalk::Access &access, bool &hit) {
+                return walkAccess(access, hit);
+            });
+
+        if (result.counterUpdate == SecCounters::Overflowed) {
+            stats.counterOverflows++;
+        }
+        stats.reencryptedBlocks += result.reencryptedBlocks;
+        if (result.pinnedAccess) stats.pinnedAccesses++;
+
+        // Rehashing may evict further blocks in turn
+        bool hit;
+        while (!treeUpdates.empty()) {
+            Addr parent = treeUpdates.back().first;
+            treeUpdates.pop_back();
+
+            metaAccess(parent, true, hit);
+        }
+
+        stats.walkLevels += result.levels;
+
+        if (is_read) {
+            stats.readLatency += result.latency;
+        } else {
+            stats.writeLatency += result.latency;
+        }
+    }
+};
+
+/**
+ * Read the trace line by line, so that its size does not matter.
+ *
+ * @param maxAccesses stop after this many accesses, 0 for all
+ * @param replay called for every access
+ */
+bool
+readTrace(const char *path, uint64_t maxAccesses,
+          const std::function<void(const Access &)> &replay)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Cannot open trace %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    unsigned long line_nr = 0;
+    uint64_t accesses = 0;
+    while ((maxAccesses == 0 || accesses < maxAccesses) &&
+           fgets(line, sizeof(line), file) != nullptr) {
+        line_nr++;
+
+        char *tokens[3];
+        int num_tokens = 0;
+        for (char *tok = strtok(line, " \t\r\n,"); tok != nullptr;
+             tok = strtok(nullptr, " \t\r\n,")) {
+            if (num_tokens < 3) tokens[num_tokens] = tok;
+            num_tokens++;
+        }
+
+        if (num_tokens == 0 || tokens[0][0] == '#') continue;
+
+        // An optional tick comes first
+        int op = num_tokens == 3 ? 1 : 0;
+        char kind = tolower(tokens[op][0]);
+        char *end;
+        Addr addr = num_tokens < 2 || num_tokens > 3 ? 0 :
+            strtoull(tokens[op + 1], &end, 0);
+
+        if ((kind != 'r' && kind != 'w') || num_tokens < 2 ||
+            num_tokens > 3 || *end != '\0') {
+            fprintf(stderr, "Bad access on line %lu of %s\n", line_nr,
+                    path);
+            if (file != stdin) fclose(file);
+            return false;
+        }
+
+        replay(Access{addr, kind == 'w'});
+        accesses++;
+    }
+
+    if (file != stdin) fclose(file);
+
+    return true;
+}
+
+void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-c config]... [-n max_accesses] trace\n"
+            "\n"
+            "Replays the trace, - for stdin, through every configuration\n"
+            "and prints one CSV line of statistics per configuration.\n"
+            "Configuration keys:\n", prog);
+    for (const auto &key : configKeys()) {
+        fprintf(stderr, "  %s\n", key.first.c_str());
+    }
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char **argv)
+{
+    std::vector<ReplayConfig> configs;
+    uint64_t max_accesses = 0;
+    const char *trace_path = nullptr;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+            if (!expandConfig(argv[++i], configs)) return 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+            if (!parseUnsigned(argv[++i], max_accesses)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (trace_path == nullptr && argv[i][0] != '-') {
+            trace_path = argv[i];
+        } else if (trace_path == nullptr && strcmp(argv[i], "-") == 0) {
+            trace_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (trace_path == nullptr) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (configs.empty()) expandConfig("", configs);
+
+    std::vector<std::unique_ptr<Replayer>> replayers;
+    for (const auto &config : configs) {
+        replayers.emplace_back(new Replayer(config));
+
+        std::string error = replayers.back()->error();
+        if (!error.empty()) {
+            fprintf(stderr, "Configuration %s: %s\n", config.name.c_str(),
+                    error.c_str());
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // A single pass over the trace feeds every configuration
+    uint64_t replayed = 0;
+    uint64_t skipped = 0;
+    bool ok = readTrace(trace_path, max_accesses,
+        [&](const Access &access) {
+            for (auto &replayer : replayers) {
+                if (access.addr >= replayer->dataSize()) {
+                    skipped++;
+                } else {
+                    replayer->access(access.addr, !access.isWrite);
+                    replayed++;
+                }
+            }
+        });
+    if (!ok) return 1;
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    printf("config,reads,writes,counter_hit_rate,mac_hit_rate,"
+           "tree_hit_rate,avg_walk_levels,pinned_accesses,"
+           "counter_overflows,reencrypted_blocks,"
+           "eviction_updates,meta_bytes_read,meta_bytes_written,"
+           "avg_read_latency_ns,avg_write_latency_ns\n");
+
+    auto ratio = [](uint64_t a, uint64_t b) {
+        return b == 0 ? 0.0 : double(a) / b;
+    };
+
+    for (const auto &replayer : replayers) {
+        const Replayer::Stats &s = replayer->stats;
+        printf("\"%s\",%lu,%lu,%.4f,%.4f,%.4f,%.3f,%lu,%lu,%lu,%lu,%lu,"
+               "%lu,%.2f,%.2f\n",
+               replayer->getConfig().name.c_str(),
+               (unsigned long)s.reads, (unsigned long)s.writes,
+               ratio(s.counterHits, s.counterHits + s.counterMisses),
+               ratio(s.macHits, s.macHits + s.macMisses),
+               ratio(s.mtHits, s.mtHits + s.mtMisses),
+               ratio(s.walkLevels, s.reads + s.writes),
+               (unsigned long)s.pinnedAccesses,
+               (unsigned long)s.counterOverflows,
+               (unsigned long)s.reencryptedBlocks,
+               (unsigned long)s.evictionUpdates,
+               (unsigned long)(s.metaBlocksRead * NODE_SPACE),
+               (unsigned long)(s.metaBlocksWritten * NODE_SPACE),
+               ratio(s.readLatency, s.reads),
+               ratio(s.writeLatency, s.writes));
+    }
+
+    fprintf(stderr, "Replayed %lu accesses in %zu configurations in %.3f s, "
+            "%.2f M accesses/s", (unsigned long)replayed, replayers.size(),
+            elapsed.count(), replayed / elapsed.count() / 1e6);
+    if (skipped != 0) {
+        fprintf(stderr, ", %lu beyond the protected data skipped",
+                (unsigned long)skipped);
+    }
+    fprintf(stderr, "\n");
+
+    return 0;
+}